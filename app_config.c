@@ -0,0 +1,172 @@
+#include "app_config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Buffers larger than this are surely a typo. */
+#define APP_CONFIG_MAX_SIZE (1024 * 1024)
+#define APP_CONFIG_MAX_BUDGET (1024 * 1024 * 1024)
+
+typedef enum {
+    PRV_STRING,
+    PRV_SIZE,
+    PRV_UINT
+} prv_type_t;
+
+typedef struct {
+    const char* key;
+    prv_type_t type;
+    size_t offset;
+    size_t size;
+    /* Max value of numbers. */
+    unsigned long max;
+} prv_field_t;
+
+#define PRV_FIELD(name, type, max) \
+    { #name, type, offsetof(app_config_t, name), \
+        sizeof(((app_config_t*)0)->name), max }
+
+static const prv_field_t m_fields[] = {
+    PRV_FIELD(app_id, PRV_STRING, 0),
+    PRV_FIELD(app_host, PRV_STRING, 0),
+    PRV_FIELD(handler_http_buff_size, PRV_SIZE, APP_CONFIG_MAX_SIZE),
+    PRV_FIELD(handler_mqtt_buff_size, PRV_SIZE, APP_CONFIG_MAX_SIZE),
+    PRV_FIELD(updater_http_buff_size, PRV_SIZE, APP_CONFIG_MAX_SIZE),
+    PRV_FIELD(handler_token_num, PRV_SIZE, APP_CONFIG_MAX_SIZE),
+    PRV_FIELD(updater_token_num, PRV_SIZE, APP_CONFIG_MAX_SIZE),
+    PRV_FIELD(update_period_sec, PRV_UINT, UINT_MAX),
+    PRV_FIELD(keep_alive_sec, PRV_UINT, UINT_MAX),
+    PRV_FIELD(recv_timeout_sec, PRV_UINT, UINT_MAX),
+    PRV_FIELD(send_timeout_sec, PRV_UINT, UINT_MAX),
+    PRV_FIELD(memory_budget, PRV_SIZE, APP_CONFIG_MAX_BUDGET)
+};
+
+#define PRV_FIELD_NUM (sizeof(m_fields) / sizeof(m_fields[0]))
+
+static char* prv_trim(char* str)
+{
+    char* end;
+    while (isspace((unsigned char)*str)) {
+        str++;
+    }
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) {
+        end--;
+    }
+    *end = '\0';
+    return str;
+}
+
+static int prv_set(app_config_t* config, const prv_field_t* field,
+        const char* value)
+{
+    char* dest = (char*)config + field->offset;
+    char* end;
+    unsigned long num;
+
+    if (field->type == PRV_STRING) {
+        if (value[0] == '\0' || strlen(value) >= field->size) {
+            return -1;
+        }
+        strcpy(dest, value);
+        return 0;
+    }
+    if (value[0] == '-') {
+        return -1;
+    }
+    errno = 0;
+    num = strtoul(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || num == 0
+            || num > field->max) {
+        return -1;
+    }
+    if (field->type == PRV_SIZE) {
+        *(size_t*)dest = num;
+    } else {
+        *(unsigned int*)dest = num;
+    }
+    return 0;
+}
+
+int app_config_load(const char* path, app_config_t* config)
+{
+    char line[256];
+    int line_num = 0;
+    int ret = 0;
+
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        if (errno == ENOENT) {
+            return 1;
+        }
+        printf("failed to open %s.\n", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line_num++;
+        char* key = prv_trim(line);
+        if (key[0] == '\0' || key[0] == '#') {
+            continue;
+        }
+        char* eq = strchr(key, '=');
+        if (eq == NULL) {
+            printf("%s:%d: expected key = value.\n", path, line_num);
+            ret = -1;
+            break;
+        }
+        *eq = '\0';
+        key = prv_trim(key);
+        char* value = prv_trim(eq + 1);
+
+        const prv_field_t* field = NULL;
+        for (size_t i = 0; i < PRV_FIELD_NUM; ++i) {
+            if (strcmp(m_fields[i].key, key) == 0) {
+                field = &m_fields[i];
+                break;
+            }
+        }
+        if (field == NULL) {
+            printf("%s:%d: unknown key %s.\n", path, line_num, key);
+            ret = -1;
+            break;
+        }
+        if (prv_set(config, field, value) != 0) {
+            printf("%s:%d: invalid value of %s: %s\n", path, line_num, key,
+                    value);
+            ret = -1;
+            break;
+        }
+    }
+    if (ret == 0 && ferror(fp)) {
+        printf("failed to read %s.\n", path);
+        ret = -1;
+    }
+    fclose(fp);
+    return ret;
+}
+
+void app_config_print(const app_config_t* config)
+{
+    printf("config:\n");
+    for (size_t i = 0; i < PRV_FIELD_NUM; ++i) {
+        const prv_field_t* field = &m_fields[i];
+        const char* src = (const char*)config + field->offset;
+        switch (field->type) {
+            case PRV_STRING:
+                printf("  %s = %s\n", field->key, src);
+                break;
+            case PRV_SIZE:
+                printf("  %s = %zu\n", field->key, *(const size_t*)src);
+                break;
+            case PRV_UINT:
+                printf("  %s = %u\n", field->key, *(const unsigned int*)src);
+                break;
+        }
+    }
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
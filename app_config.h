@@ -0,0 +1,52 @@
+#ifndef __APP_CONFIG
+#define __APP_CONFIG
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APP_CONFIG_ID_SIZE 64
+#define APP_CONFIG_HOST_SIZE 128
+
+/* Settings read at startup. Defaults are the values in example.h. */
+typedef struct {
+    char app_id[APP_CONFIG_ID_SIZE];
+    char app_host[APP_CONFIG_HOST_SIZE];
+    size_t handler_http_buff_size;
+    size_t handler_mqtt_buff_size;
+    size_t updater_http_buff_size;
+    /* Number of JSON tokens to parse a message. */
+    size_t handler_token_num;
+    size_t updater_token_num;
+    unsigned int update_period_sec;
+    unsigned int keep_alive_sec;
+    unsigned int recv_timeout_sec;
+    unsigned int send_timeout_sec;
+    /* Bytes of memory reserved at startup may take. 0 to derive it from
+     * the buffer sizes. */
+    size_t memory_budget;
+} app_config_t;
+
+/** Override settings with the values in a file.
+ *
+ * One "key = value" per line. Keys are the field names of app_config_t.
+ * Lines starting with '#' and empty lines are ignored.
+ *
+ * @param [in] path path of config file.
+ * @param [in,out] config settings to override.
+ *
+ * @return 0 if succeeded, 1 if the file does not exist, -1 if it can not be
+ * read or has an unknown key or an invalid value.
+ */
+int app_config_load(const char* path, app_config_t* config);
+
+void app_config_print(const app_config_t* config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __APP_CONFIG */
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,209 @@
+#include "buff_region.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PRV_ALIGN 16
+
+static size_t prv_round_up(size_t value, size_t step)
+{
+    return (value + step - 1) / step * step;
+}
+
+void buff_region_init(buff_region_t* region)
+{
+    memset(region, 0, sizeof(*region));
+}
+
+int buff_region_add(
+        buff_region_t* region,
+        const char* name,
+        size_t unit,
+        size_t num,
+        int count)
+{
+    if (region->mem != NULL || region->kind_num >= BUFF_REGION_MAX_KINDS) {
+        return -1;
+    }
+    buff_region_kind_t* kind = &region->kinds[region->kind_num];
+    kind->name = name;
+    kind->unit = unit;
+    kind->num = num;
+    kind->count = count;
+    kind->stride = prv_round_up(unit * num, PRV_ALIGN);
+    return region->kind_num++;
+}
+
+size_t buff_region_size(const buff_region_t* region)
+{
+    size_t size = 0;
+    for (int i = 0; i < region->kind_num; ++i) {
+        size += region->kinds[i].stride * region->kinds[i].count;
+    }
+    return size;
+}
+
+int buff_region_alloc(buff_region_t* region)
+{
+    size_t size = buff_region_size(region);
+    if (region->mem != NULL || size == 0) {
+        return -1;
+    }
+    region->mem = aligned_alloc(PRV_ALIGN, size);
+    if (region->mem == NULL) {
+        return -1;
+    }
+    region->size = size;
+    memset(region->mem, 0x00, size);
+    unsigned char* p = region->mem;
+    for (int i = 0; i < region->kind_num; ++i) {
+        region->kinds[i].base = p;
+        p += region->kinds[i].stride * region->kinds[i].count;
+    }
+    return 0;
+}
+
+void* buff_region_get(const buff_region_t* region, int kind, int index)
+{
+    const buff_region_kind_t* k = &region->kinds[kind];
+    return k->base + k->stride * index;
+}
+
+/* Bytes up to the last non-zero one. */
+static size_t prv_used_bytes(const unsigned char* buff, size_t size)
+{
+    size_t i = size;
+    while (i > 0 && buff[i - 1] == 0x00) {
+        i--;
+    }
+    return i;
+}
+
+void buff_region_track(buff_region_t* region, const void* ptr, size_t length)
+{
+    const unsigned char* p = (const unsigned char*)ptr;
+    for (int i = 0; i < region->kind_num; ++i) {
+        buff_region_kind_t* k = &region->kinds[i];
+        if (p < k->base || p >= k->base + k->stride * k->count) {
+            continue;
+        }
+        size_t end = (size_t)(p - k->base) % k->stride + length;
+        size_t used = (end + k->unit - 1) / k->unit;
+        if (used > k->num) {
+            used = k->num;
+        }
+        size_t peak = atomic_load(&k->tracked_peak);
+        while (used > peak
+                && !atomic_compare_exchange_weak(&k->tracked_peak, &peak,
+                    used)) {
+        }
+        return;
+    }
+}
+
+int buff_region_tracked(const buff_region_t* region, int kind)
+{
+    return atomic_load(&region->kinds[kind].tracked_peak) > 0;
+}
+
+size_t buff_region_peak(const buff_region_t* region, int kind)
+{
+    const buff_region_kind_t* k = &region->kinds[kind];
+    size_t peak = atomic_load(&k->tracked_peak);
+    for (int i = 0; i < k->count; ++i) {
+        size_t used = prv_used_bytes(k->base + k->stride * i, k->unit * k->num);
+        used = (used + k->unit - 1) / k->unit;
+        if (used > peak) {
+            peak = used;
+        }
+    }
+    return peak;
+}
+
+int buff_region_full(const buff_region_t* region, int kind)
+{
+    return buff_region_peak(region, kind) >= region->kinds[kind].num;
+}
+
+size_t buff_region_recommend(const buff_region_t* region, int kind)
+{
+    const buff_region_kind_t* k = &region->kinds[kind];
+    size_t peak = buff_region_peak(region, kind);
+    if (peak == 0) {
+        return 0;
+    }
+    if (peak >= k->num || !buff_region_tracked(region, kind)) {
+        // Unknown how much more was needed.
+        return k->num;
+    }
+    size_t step = k->unit == 1 ? BUFF_REGION_ROUND_BYTES : BUFF_REGION_ROUND_ELEMENTS;
+    return prv_round_up(peak + peak / 4, step);
+}
+
+static void prv_appendf(char* out, size_t out_size, size_t* len,
+        const char* format, ...)
+{
+    va_list args;
+    if (*len >= out_size) {
+        return;
+    }
+    va_start(args, format);
+    int ret = vsnprintf(&out[*len], out_size - *len, format, args);
+    va_end(args);
+    if (ret > 0) {
+        *len += ret;
+    }
+}
+
+void buff_region_print_report(const buff_region_t* region)
+{
+    printf("sizing (lines for config file):\n");
+    for (int i = 0; i < region->kind_num; ++i) {
+        const buff_region_kind_t* k = &region->kinds[i];
+        size_t peak = buff_region_peak(region, i);
+        size_t recommended = buff_region_recommend(region, i);
+        if (recommended == 0) {
+            printf("# %s: not used yet, now %zu\n", k->name, k->num);
+            continue;
+        }
+        if (buff_region_full(region, i)) {
+            printf("%s = %zu  # peak unknown (at least %zu), "
+                    "FULL: may be too small\n", k->name, recommended, k->num);
+            continue;
+        }
+        if (!buff_region_tracked(region, i)) {
+            printf("%s = %zu  # peak at least %zu (not tracked), now %zu\n",
+                    k->name, recommended, peak, k->num);
+            continue;
+        }
+        printf("%s = %zu  # peak %zu, now %zu\n", k->name, recommended,
+                peak, k->num);
+    }
+}
+
+size_t buff_region_report_json(
+        const buff_region_t* region,
+        char* out,
+        size_t out_size)
+{
+    size_t len = 0;
+    prv_appendf(out, out_size, &len, "{");
+    for (int i = 0; i < region->kind_num; ++i) {
+        prv_appendf(out, out_size, &len,
+                "%s\"%s\":{\"peak\":%zu,\"recommended\":%zu,\"current\":%zu,"
+                "\"full\":%s,\"tracked\":%s}",
+                i > 0 ? "," : "",
+                region->kinds[i].name,
+                buff_region_peak(region, i),
+                buff_region_recommend(region, i),
+                region->kinds[i].num,
+                buff_region_full(region, i) ? "true" : "false",
+                buff_region_tracked(region, i) ? "true" : "false");
+    }
+    prv_appendf(out, out_size, &len, "}");
+    return len < out_size ? len : out_size - 1;
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
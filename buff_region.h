@@ -0,0 +1,111 @@
+#ifndef __BUFF_REGION
+#define __BUFF_REGION
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BUFF_REGION_MAX_KINDS 8
+/* Recommended size is peak + 25%, rounded up to this many bytes, or to
+ * BUFF_REGION_ROUND_ELEMENTS for arrays of larger elements. */
+#define BUFF_REGION_ROUND_BYTES 64
+#define BUFF_REGION_ROUND_ELEMENTS 8
+
+/** Buffers of the same use and size, e.g. MQTT buffers of all things. */
+typedef struct {
+    /* Shown in reports. Use the config key of its size. */
+    const char* name;
+    /* Bytes of one element: 1 for byte buffers. */
+    size_t unit;
+    /* Elements in each buffer. */
+    size_t num;
+    int count;
+    /* Bytes from one buffer to the next. */
+    size_t stride;
+    unsigned char* base;
+    /* Max elements used, seen by buff_region_track(). */
+    atomic_size_t tracked_peak;
+} buff_region_kind_t;
+
+/* All SDK buffers and token pools in one allocation made at startup. */
+typedef struct {
+    buff_region_kind_t kinds[BUFF_REGION_MAX_KINDS];
+    int kind_num;
+    unsigned char* mem;
+    size_t size;
+} buff_region_t;
+
+void buff_region_init(buff_region_t* region);
+
+/** Plan buffers. Call before buff_region_alloc().
+ *
+ * @param [in] name name of the kind.
+ * @param [in] unit bytes of one element.
+ * @param [in] num elements in each buffer.
+ * @param [in] count number of buffers.
+ *
+ * @return id of the kind, or -1 if no room.
+ */
+int buff_region_add(
+        buff_region_t* region,
+        const char* name,
+        size_t unit,
+        size_t num,
+        int count);
+
+/** Total bytes of planned buffers. */
+size_t buff_region_size(const buff_region_t* region);
+
+/** Allocate all planned buffers filled with zero, as the SDK expects.
+ *
+ * @return 0 if succeeded, otherwise -1.
+ */
+int buff_region_alloc(buff_region_t* region);
+
+/** Buffer index of a kind. */
+void* buff_region_get(const buff_region_t* region, int kind, int index);
+
+/** Note that length bytes from ptr are used, e.g. data sent from or
+ * received into a buffer. Pointers out of the region are ignored.
+ * Thread safe. */
+void buff_region_track(buff_region_t* region, const void* ptr, size_t length);
+
+/** Non-zero if buff_region_track() has seen a buffer of the kind used. */
+int buff_region_tracked(const buff_region_t* region, int kind);
+
+/** Max elements ever used in a buffer of the kind.
+ *
+ * The larger of the tracked peak and the last non-zero byte left in the
+ * buffers. The latter is only a lower bound: data the SDK cleared and
+ * zeros at the end, such as a NUL terminator, are not seen. If it equals
+ * the current size, the buffer was full and the real need is unknown. */
+size_t buff_region_peak(const buff_region_t* region, int kind);
+
+/** Size to configure for the kind from its peak. 0 if never used.
+ * Never less than the current size if the kind is not tracked, as its
+ * peak is only a lower bound, or if the buffer was full. */
+size_t buff_region_recommend(const buff_region_t* region, int kind);
+
+/** Non-zero if a buffer of the kind was used up to its end. */
+int buff_region_full(const buff_region_t* region, int kind);
+
+/** Print peak and recommended sizes as lines of config file. */
+void buff_region_print_report(const buff_region_t* region);
+
+/** Write peak and recommended sizes as JSON.
+ *
+ * @return length of the JSON. */
+size_t buff_region_report_json(
+        const buff_region_t* region,
+        char* out,
+        size_t out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BUFF_REGION */
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,144 @@
+#include "cmd_queue.h"
+
+#include <string.h>
+#include <time.h>
+
+static uint64_t prv_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void* prv_worker(void* param)
+{
+    cmd_queue_t* queue = (cmd_queue_t*)param;
+    cmd_queue_cmd_t cmd;
+
+    pthread_mutex_lock(&queue->mutex);
+    while (1) {
+        while (queue->count == 0 && !queue->stopped) {
+            pthread_cond_wait(&queue->cond, &queue->mutex);
+        }
+        if (queue->count == 0) {
+            break;
+        }
+        cmd = queue->cmds[queue->head];
+        queue->head = (queue->head + 1) % CMD_QUEUE_CAPACITY;
+        queue->count--;
+        queue->stats.depth = queue->count;
+        pthread_mutex_unlock(&queue->mutex);
+
+        queue->exec_cb(&cmd, queue->exec_userdata);
+        uint64_t latency = prv_now_us() - cmd.enqueued_us;
+
+        pthread_mutex_lock(&queue->mutex);
+        queue->stats.executed++;
+        queue->stats.last_latency_us = latency;
+        queue->stats.total_latency_us += latency;
+        if (latency > queue->stats.max_latency_us) {
+            queue->stats.max_latency_us = latency;
+        }
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return NULL;
+}
+
+int cmd_queue_start(
+        cmd_queue_t* queue,
+        CMD_QUEUE_EXEC_CB exec_cb,
+        void* userdata)
+{
+    memset(queue, 0, sizeof(*queue));
+    queue->exec_cb = exec_cb;
+    queue->exec_userdata = userdata;
+    if (pthread_mutex_init(&queue->mutex, NULL) != 0) {
+        return -1;
+    }
+    if (pthread_cond_init(&queue->cond, NULL) != 0) {
+        pthread_mutex_destroy(&queue->mutex);
+        return -1;
+    }
+    if (pthread_create(&queue->worker, NULL, prv_worker, queue) != 0) {
+        pthread_cond_destroy(&queue->cond);
+        pthread_mutex_destroy(&queue->mutex);
+        return -1;
+    }
+    return 0;
+}
+
+cmd_queue_code_t cmd_queue_push(
+        cmd_queue_t* queue,
+        void* target,
+        const char* alias,
+        const char* action_name,
+        int bool_value,
+        uint32_t trace_id)
+{
+    cmd_queue_code_t ret = CMD_QUEUE_OK;
+    uint64_t now = prv_now_us();
+
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->stopped) {
+        pthread_mutex_unlock(&queue->mutex);
+        return CMD_QUEUE_STOPPED;
+    }
+
+    /* Latest wins: overwrite a pending command for the same target. */
+    for (size_t i = 0; i < queue->count; ++i) {
+        cmd_queue_cmd_t* pending =
+            &queue->cmds[(queue->head + i) % CMD_QUEUE_CAPACITY];
+        if (pending->target == target &&
+                strcmp(pending->alias, alias) == 0 &&
+                strcmp(pending->action_name, action_name) == 0) {
+            pending->bool_value = bool_value;
+            pending->enqueued_us = now;
+            pending->trace_id = trace_id;
+            queue->stats.coalesced++;
+            pthread_mutex_unlock(&queue->mutex);
+            return CMD_QUEUE_OK;
+        }
+    }
+
+    if (queue->count == CMD_QUEUE_CAPACITY) {
+        queue->stats.rejected++;
+        ret = CMD_QUEUE_FULL;
+    } else {
+        cmd_queue_cmd_t* cmd =
+            &queue->cmds[(queue->head + queue->count) % CMD_QUEUE_CAPACITY];
+        memset(cmd, 0, sizeof(*cmd));
+        cmd->target = target;
+        strncpy(cmd->alias, alias, sizeof(cmd->alias) - 1);
+        strncpy(cmd->action_name, action_name, sizeof(cmd->action_name) - 1);
+        cmd->bool_value = bool_value;
+        cmd->enqueued_us = now;
+        cmd->trace_id = trace_id;
+        queue->count++;
+        queue->stats.enqueued++;
+        queue->stats.depth = queue->count;
+        if (queue->count > queue->stats.max_depth) {
+            queue->stats.max_depth = queue->count;
+        }
+        pthread_cond_signal(&queue->cond);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return ret;
+}
+
+void cmd_queue_get_stats(cmd_queue_t* queue, cmd_queue_stats_t* out_stats)
+{
+    pthread_mutex_lock(&queue->mutex);
+    *out_stats = queue->stats;
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+void cmd_queue_stop(cmd_queue_t* queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    queue->stopped = 1;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+    pthread_join(queue->worker, NULL);
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,110 @@
+#ifndef __CMD_QUEUE
+#define __CMD_QUEUE
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CMD_QUEUE_CAPACITY
+#define CMD_QUEUE_CAPACITY 16
+#endif
+#define CMD_QUEUE_ALIAS_SIZE 64
+#define CMD_QUEUE_ACTION_NAME_SIZE 64
+
+typedef enum {
+    CMD_QUEUE_OK,
+    CMD_QUEUE_FULL,
+    CMD_QUEUE_STOPPED
+} cmd_queue_code_t;
+
+/** A command waiting to be applied to the device. */
+typedef struct {
+    /* Device the command is for. Opaque to the queue. */
+    void* target;
+    char alias[CMD_QUEUE_ALIAS_SIZE];
+    char action_name[CMD_QUEUE_ACTION_NAME_SIZE];
+    int bool_value;
+    /* CLOCK_MONOTONIC time in microseconds the command was (re)queued. */
+    uint64_t enqueued_us;
+    /* Trace of the command, 0 if not traced. See trace.h */
+    uint32_t trace_id;
+} cmd_queue_cmd_t;
+
+/** Called from the worker thread for each command taken from the queue.
+ *
+ * @param [in] cmd command to apply.
+ * @param [in] userdata userdata given to cmd_queue_start().
+ */
+typedef void (*CMD_QUEUE_EXEC_CB)(const cmd_queue_cmd_t* cmd, void* userdata);
+
+typedef struct {
+    size_t depth;
+    size_t max_depth;
+    unsigned long enqueued;
+    unsigned long coalesced;
+    unsigned long rejected;
+    unsigned long executed;
+    /* Latency from enqueue to the end of execution, in microseconds. */
+    uint64_t last_latency_us;
+    uint64_t max_latency_us;
+    uint64_t total_latency_us;
+} cmd_queue_stats_t;
+
+typedef struct {
+    cmd_queue_cmd_t cmds[CMD_QUEUE_CAPACITY];
+    size_t head;
+    size_t count;
+    int stopped;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t worker;
+    CMD_QUEUE_EXEC_CB exec_cb;
+    void* exec_userdata;
+    cmd_queue_stats_t stats;
+} cmd_queue_t;
+
+/** Initialize queue and start its worker thread.
+ *
+ * @param [out] queue queue to start.
+ * @param [in] exec_cb callback to apply commands.
+ * @param [in] userdata passed to exec_cb.
+ *
+ * @return 0 if succeeded, otherwise -1.
+ */
+int cmd_queue_start(
+        cmd_queue_t* queue,
+        CMD_QUEUE_EXEC_CB exec_cb,
+        void* userdata);
+
+/** Queue a command.
+ *
+ * If a command with the same target, alias and action name is still waiting,
+ * it is replaced by this one in place, so only the latest value is applied.
+ *
+ * @return CMD_QUEUE_OK if the command is accepted. CMD_QUEUE_FULL if the
+ * queue has no room, CMD_QUEUE_STOPPED if the queue is stopped.
+ */
+cmd_queue_code_t cmd_queue_push(
+        cmd_queue_t* queue,
+        void* target,
+        const char* alias,
+        const char* action_name,
+        int bool_value,
+        uint32_t trace_id);
+
+/** Copy current statistics of the queue. */
+void cmd_queue_get_stats(cmd_queue_t* queue, cmd_queue_stats_t* out_stats);
+
+/** Stop the worker after the pending commands are applied. */
+void cmd_queue_stop(cmd_queue_t* queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CMD_QUEUE */
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,141 @@
+#include "cred_store.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Version 1 files have no app id and host, and are not loaded. */
+#define CRED_STORE_MAGIC "thing-if-credentials 2"
+
+static int prv_read_line(FILE* fp, char* buff, size_t size)
+{
+    if (fgets(buff, size, fp) == NULL) {
+        return -1;
+    }
+    size_t len = strlen(buff);
+    if (len == 0 || buff[len - 1] != '\n') {
+        /* Truncated or too long. */
+        return -1;
+    }
+    buff[len - 1] = '\0';
+    return 0;
+}
+
+static int prv_expect_line(FILE* fp, const char* expected)
+{
+    char line[256];
+    if (prv_read_line(fp, line, sizeof(line)) != 0
+            || strcmp(line, expected) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int cred_store_load(
+        const char* path,
+        const char* app_id,
+        const char* app_host,
+        const char* vendor_thing_id,
+        kii_author_t* out_author)
+{
+    kii_author_t author;
+    int ret = -1;
+
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    memset(&author, 0, sizeof(author));
+    if (prv_expect_line(fp, CRED_STORE_MAGIC) != 0
+            || prv_expect_line(fp, app_id) != 0
+            || prv_expect_line(fp, app_host) != 0
+            || prv_expect_line(fp, vendor_thing_id) != 0) {
+        goto exit;
+    }
+    if (prv_read_line(fp, author.author_id, sizeof(author.author_id)) != 0
+            || author.author_id[0] == '\0') {
+        goto exit;
+    }
+    if (prv_read_line(fp, author.access_token, sizeof(author.access_token)) != 0
+            || author.access_token[0] == '\0') {
+        goto exit;
+    }
+    *out_author = author;
+    ret = 0;
+exit:
+    fclose(fp);
+    return ret;
+}
+
+int cred_store_save(
+        const char* path,
+        const char* app_id,
+        const char* app_host,
+        const char* vendor_thing_id,
+        const kii_author_t* author)
+{
+    char tmp_path[PATH_MAX];
+    char dir_path[PATH_MAX];
+
+    int len = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (len < 0 || (size_t)len >= sizeof(tmp_path)) {
+        return -1;
+    }
+    strncpy(dir_path, path, sizeof(dir_path) - 1);
+    dir_path[sizeof(dir_path) - 1] = '\0';
+    char* dir = dirname(dir_path);
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        return -1;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    FILE* fp = fdopen(fd, "w");
+    if (fp == NULL) {
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    int written = fprintf(fp, "%s\n%s\n%s\n%s\n%s\n%s\n",
+            CRED_STORE_MAGIC,
+            app_id,
+            app_host,
+            vendor_thing_id,
+            author->author_id,
+            author->access_token);
+    if (written < 0 || fflush(fp) != 0 || fsync(fd) != 0) {
+        fclose(fp);
+        unlink(tmp_path);
+        return -1;
+    }
+    if (fclose(fp) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    /* Make the rename itself durable. */
+    int dir_fd = open(dir, O_RDONLY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    return 0;
+}
+
+int cred_store_remove(const char* path)
+{
+    if (unlink(path) != 0 && errno != ENOENT) {
+        return -1;
+    }
+    return 0;
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
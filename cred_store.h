@@ -0,0 +1,59 @@
+#ifndef __CRED_STORE
+#define __CRED_STORE
+
+#include <tio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Load author stored by cred_store_save().
+ *
+ * Credentials stored for another app, host or thing are not loaded, e.g.
+ * after the app is moved to another site in the config file.
+ *
+ * @param [in] path path of credential file.
+ * @param [in] app_id app id the author must belong to.
+ * @param [in] app_host app host the author must belong to.
+ * @param [in] vendor_thing_id vendor thing id the author must belong to.
+ * @param [out] out_author loaded author.
+ *
+ * @return 0 if a valid author for the app and vendor_thing_id is loaded,
+ * otherwise -1.
+ */
+int cred_store_load(
+        const char* path,
+        const char* app_id,
+        const char* app_host,
+        const char* vendor_thing_id,
+        kii_author_t* out_author);
+
+/** Store author of the thing.
+ *
+ * The file is created with mode 0600 and replaced atomically, so a power
+ * loss leaves either the old or the new credentials.
+ *
+ * @param [in] path path of credential file.
+ * @param [in] app_id app id the author belongs to.
+ * @param [in] app_host app host the author belongs to.
+ * @param [in] vendor_thing_id vendor thing id the author belongs to.
+ * @param [in] author author to store.
+ *
+ * @return 0 if succeeded, otherwise -1.
+ */
+int cred_store_save(
+        const char* path,
+        const char* app_id,
+        const char* app_host,
+        const char* vendor_thing_id,
+        const kii_author_t* author);
+
+/** Remove stored author, e.g. when the server rejects its token. */
+int cred_store_remove(const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CRED_STORE */
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -11,128 +11,611 @@
 #include <pthread.h>
 #include <unistd.h>
 #include "sys_cb_impl.h"
-#include "pi_control.h"
+#include "app_config.h"
+#include "buff_region.h"
+#include "hal.h"
+#include "cmd_queue.h"
+#include "mem_pool.h"
+#include "cred_store.h"
+#include "sock_trace.h"
+#include "local_api.h"
+#include "state_encoding.h"
+#include "state_store.h"
+#include "trace.h"
+#include "upload_scheduler.h"
+#include "linux-env/task_impl.h"
 #include <stdatomic.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <sys/resource.h>
+#include <time.h>
 
 typedef struct prv_air_conditioner_t {
     kii_bool_t power;
     int temperature;
 } prv_air_conditioner_t;
 
-static prv_air_conditioner_t m_air_conditioner;
-static pthread_mutex_t m_mutex;
-
-static tio_bool_t prv_get_air_conditioner_info(
+/* Sensor and actuator behind one thing. The state is uploaded by the
+ * updater of the thing. */
+typedef struct {
+    state_store_t store;
+    wakeable_delay_t updater_delay;
+    /* Serializes reads of the sensor by the updater and the sampler. */
+    pthread_mutex_t sensor_mutex;
+    /* trace_now_us() of the last sensor read. */
+    _Atomic uint64_t sampled_us;
+    int has_sensor;
+    /* Probe to read, see hal_list_probes(). Empty for the sensor of
+     * hal_read_temperature(). */
+    char probe_id[HAL_PROBE_ID_SIZE];
+    int has_led;
+    /* Trace of the last action whose state is not uploaded yet. */
+    atomic_uint push_trace_id;
+    _Atomic uint64_t push_requested_us;
+} device_t;
+
+static app_config_t m_config;
+/* SDK buffers and token pools of all things. */
+static buff_region_t m_buffers;
+static int m_handler_http_buffs;
+static int m_handler_mqtt_buffs;
+static int m_updater_http_buffs;
+static int m_handler_tokens;
+static int m_updater_tokens;
+
+static cmd_queue_t m_cmd_queue;
+static local_api_t m_local_api;
+static const char* m_trace_file = TRACE_EXPORT_PATH;
+
+static void prv_to_air_conditioner(
+        const device_state_t* state,
         prv_air_conditioner_t* air_conditioner)
 {
-    if (pthread_mutex_lock(&m_mutex) != 0) {
-        return KII_FALSE;
+    air_conditioner->power = state->power ? KII_TRUE : KII_FALSE;
+    air_conditioner->temperature = state->temperature;
+}
+
+static void prv_device_init(device_t* device)
+{
+    memset(device, 0, sizeof(*device));
+    state_store_init(&device->store);
+    wakeable_delay_init(&device->updater_delay, STATE_PUSH_DEBOUNCE_MS);
+    pthread_mutex_init(&device->sensor_mutex, NULL);
+    atomic_init(&device->sampled_us, 0);
+    atomic_init(&device->push_trace_id, 0);
+    atomic_init(&device->push_requested_us, 0);
+}
+
+static tio_bool_t prv_sample_sensor(device_t* device)
+{
+    pthread_mutex_lock(&device->sensor_mutex);
+    int temp = device->probe_id[0] != '\0' ?
+        hal_read_probe_temperature(device->probe_id) :
+        hal_read_temperature();
+    if (temp > -9996) {
+        state_store_set_temperature(&device->store, temp/1000);
+        device->sampled_us = trace_now_us();
     }
-    air_conditioner->power = m_air_conditioner.power;
-    int temp = readDS18B20Temparature();
+    pthread_mutex_unlock(&device->sensor_mutex);
     if (temp <= -9996) {
         printf("failed to read temperature, code: %d\n", temp);
         return KII_FALSE;
     }
-    air_conditioner->temperature = temp/1000;
-    if (pthread_mutex_unlock(&m_mutex) != 0) {
+    return KII_TRUE;
+}
+
+static tio_bool_t prv_get_air_conditioner_info(
+        device_t* device,
+        prv_air_conditioner_t* air_conditioner)
+{
+    device_state_t state;
+    if (device->has_sensor && prv_sample_sensor(device) == KII_FALSE) {
         return KII_FALSE;
     }
+    state_store_read(&device->store, &state);
+    prv_to_air_conditioner(&state, air_conditioner);
+    return KII_TRUE;
+}
+
+/* Last known state, without reading the sensor. The sampler keeps it
+ * fresh while the updater does not upload. */
+static tio_bool_t prv_get_cached_air_conditioner_info(
+        device_t* device,
+        prv_air_conditioner_t* air_conditioner)
+{
+    device_state_t state;
+    state_store_read(&device->store, &state);
+    prv_to_air_conditioner(&state, air_conditioner);
     return KII_TRUE;
 }
 
+/* out_changed is set to 1 if the state is changed, and the updater is woken
+ * to upload it. */
 static kii_bool_t prv_set_air_conditioner_info(
-        const prv_air_conditioner_t* air_conditioner)
+        device_t* device,
+        const prv_air_conditioner_t* air_conditioner,
+        int* out_changed)
 {
-    if (pthread_mutex_lock(&m_mutex) != 0) {
-        return KII_FALSE;
-    }
-    m_air_conditioner.power = air_conditioner->power;
-    if (pthread_mutex_unlock(&m_mutex) != 0) {
-        return KII_FALSE;
-    }
+    *out_changed = state_store_set_power(&device->store,
+            air_conditioner->power == KII_TRUE);
     return KII_TRUE;
 }
 
+/* Upload the state soon after an action changes it, instead of waiting for
+ * the next update period. */
+static void prv_push_state_on_change(
+        const device_state_t* state,
+        unsigned int changed,
+        void* userdata)
+{
+    delay_wake((wakeable_delay_t*)userdata);
+}
+
+/* Reads the sensor of the local API device when the updater has not read
+ * it for LOCAL_SAMPLE_PERIOD_SEC, e.g. while the cloud is unreachable or
+ * onboarding is retried. */
+typedef struct {
+    device_t* device;
+    wakeable_delay_t delay;
+    atomic_bool stopping;
+    pthread_t thread;
+} prv_sampler_t;
+
+static void* prv_sampler_main(void* arg)
+{
+    prv_sampler_t* sampler = (prv_sampler_t*)arg;
+    const uint64_t period_us = LOCAL_SAMPLE_PERIOD_SEC * 1000000ULL;
+    while (!sampler->stopping) {
+        uint64_t age_us = trace_now_us() - sampler->device->sampled_us;
+        if (age_us >= period_us) {
+            prv_sample_sensor(sampler->device);
+            age_us = 0;
+        }
+        wakeable_delay_ms_cb((unsigned int)((period_us - age_us) / 1000),
+                &sampler->delay);
+    }
+    return NULL;
+}
+
+static int prv_sampler_start(prv_sampler_t* sampler, device_t* device)
+{
+    sampler->device = device;
+    wakeable_delay_init(&sampler->delay, 0);
+    atomic_init(&sampler->stopping, false);
+    return pthread_create(&sampler->thread, NULL, prv_sampler_main, sampler)
+        == 0 ? 0 : -1;
+}
+
+static void prv_sampler_stop(prv_sampler_t* sampler)
+{
+    sampler->stopping = true;
+    delay_wake(&sampler->delay);
+    pthread_join(sampler->thread, NULL);
+}
 
 // Using C11 atomic types.
 atomic_bool term_flag = false;
-atomic_bool handler_terminated = false;
-atomic_bool updater_terminated = false;
+atomic_bool stats_requested = false;
+atomic_bool trace_export_requested = false;
 
-tio_bool_t _handler_continue(void* task_info, void* userdata) {
-    if (term_flag == true) {
-        return KII_FALSE;
-    } else {
-        return KII_TRUE;
+void sig_handler(int sig, siginfo_t *info, void *ctx) {
+    term_flag = 1;
+}
+
+void stats_sig_handler(int sig, siginfo_t *info, void *ctx) {
+    stats_requested = 1;
+}
+
+void trace_sig_handler(int sig, siginfo_t *info, void *ctx) {
+    trace_export_requested = 1;
+}
+
+static long prv_export_trace() {
+    long spans = trace_export_chrome_file(m_trace_file);
+    if (spans < 0) {
+        printf("failed to write %s.\n", m_trace_file);
     }
+    return spans;
 }
 
-tio_bool_t _updater_continue(void* task_info, void* userdata) {
-    if (term_flag == true) {
-        return KII_FALSE;
-    } else {
-        return KII_TRUE;
+/* No heap allocation is expected after the first upload and receive. */
+static unsigned int prv_warmup_sec() {
+    return m_config.update_period_sec + m_config.recv_timeout_sec;
+}
+
+static void print_memory_stats() {
+    mem_pool_stats_t stats;
+    mem_pool_get_stats(&stats);
+    printf("memory: arena in_use=%zu peak=%zu size=%zu "
+            "openssl_pool_allocs=%lu openssl_heap_allocs=%lu "
+            "process_heap=%zu\n",
+            stats.arena_in_use, stats.arena_peak, stats.arena_size,
+            stats.openssl_pool_allocs, stats.openssl_heap_allocs,
+            stats.process_heap_in_use);
+    if (stats.warm) {
+        printf("memory after warm-up: openssl_allocs=%lu "
+                "openssl_heap_allocs=%lu process_heap_growth=%ld\n",
+                stats.openssl_allocs_after_warm,
+                stats.openssl_heap_allocs_after_warm,
+                (long)stats.process_heap_in_use
+                - (long)stats.process_heap_at_warm);
     }
 }
 
-void _handler_exit(void* task_info, void* userdata) {
-    printf("_handler_exit called\n");
-    handler_terminated = true;
+/* Memory for the whole life of the process. The OpenSSL arena has room for
+ * tls_connections connections open at once. */
+static int prv_memory_init(size_t budget, size_t tls_connections) {
+    // OpenSSL allocates from the arena from here.
+    if (mem_pool_init(budget, tls_connections) != 0
+            || mem_pool_reserve("task stacks",
+                TASK_STACK_NUM * TASK_STACK_SIZE) != 0) {
+        printf("failed to set up memory\n");
+        mem_pool_print_budget();
+        return -1;
+    }
+    return 0;
 }
 
-void _updater_exit(void* task_info, void* userdata) {
-    printf("_updater_exit called\n");
-    updater_terminated = true;
+static void print_sock_trace_stats() {
+    sock_trace_stats_t stats;
+    struct rusage usage;
+    if (sock_trace_mode() == SOCK_TRACE_OFF) {
+        return;
+    }
+    sock_trace_get_stats(&stats);
+    printf("socket trace: connects=%lu sent=%lu recv=%lu\n",
+            stats.connects, stats.sent_bytes, stats.recv_bytes);
+    if (sock_trace_mode() == SOCK_TRACE_REPLAYING) {
+        printf("socket trace: send mismatches=%lu unexpected=%lu missing=%lu "
+                "recv_blocked=%lu\n",
+                stats.send_mismatches, stats.send_unexpected,
+                stats.send_missing, stats.recv_blocked);
+    }
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        printf("cpu time: user=%ld.%06lds sys=%ld.%06lds\n",
+                (long)usage.ru_utime.tv_sec, (long)usage.ru_utime.tv_usec,
+                (long)usage.ru_stime.tv_sec, (long)usage.ru_stime.tv_usec);
+    }
 }
 
-void sig_handler(int sig, siginfo_t *info, void *ctx) {
-    term_flag = 1;
+static void prv_config_init(app_config_t* config) {
+    memset(config, 0, sizeof(*config));
+    strncpy(config->app_id, KII_APP_ID, sizeof(config->app_id) - 1);
+    strncpy(config->app_host, KII_APP_HOST, sizeof(config->app_host) - 1);
+    config->handler_http_buff_size = HANDLER_HTTP_BUFF_SIZE;
+    config->handler_mqtt_buff_size = HANDLER_MQTT_BUFF_SIZE;
+    config->updater_http_buff_size = UPDATER_HTTP_BUFF_SIZE;
+    config->handler_token_num = HANDLER_TOKEN_NUM;
+    config->updater_token_num = UPDATER_TOKEN_NUM;
+    config->update_period_sec = UPDATE_PERIOD_SEC;
+    config->keep_alive_sec = HANDLER_KEEP_ALIVE_SEC;
+    config->recv_timeout_sec = TO_RECV_SEC;
+    config->send_timeout_sec = TO_SEND_SEC;
+}
+
+/* Config sizes buffers, so it is read before options are parsed. */
+static const char* prv_config_path(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--config=", 9) == 0) {
+            return &argv[i][9];
+        }
+        if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            return argv[i + 1];
+        }
+    }
+    return NULL;
+}
+
+/* Buffers of config for thing_num things. */
+static void prv_plan_buffers(buff_region_t* region,
+        const app_config_t* config, int thing_num) {
+    buff_region_init(region);
+    m_handler_http_buffs = buff_region_add(region,
+            "handler_http_buff_size", 1, config->handler_http_buff_size,
+            thing_num);
+    m_handler_mqtt_buffs = buff_region_add(region,
+            "handler_mqtt_buff_size", 1, config->handler_mqtt_buff_size,
+            thing_num);
+    m_updater_http_buffs = buff_region_add(region,
+            "updater_http_buff_size", 1, config->updater_http_buff_size,
+            thing_num);
+    m_handler_tokens = buff_region_add(region,
+            "handler_token_num", sizeof(jkii_token_t),
+            config->handler_token_num, thing_num);
+    m_updater_tokens = buff_region_add(region,
+            "updater_token_num", sizeof(jkii_token_t),
+            config->updater_token_num, thing_num);
+}
+
+/* memory_budget of the config, or budget, which fits the buffers of
+ * example.h, enlarged by what the configured buffers take beyond them. */
+static size_t prv_memory_budget(size_t budget, int thing_num) {
+    app_config_t defaults;
+    buff_region_t region;
+
+    if (m_config.memory_budget != 0) {
+        return m_config.memory_budget;
+    }
+    prv_config_init(&defaults);
+    prv_plan_buffers(&region, &defaults, thing_num);
+    size_t default_size = buff_region_size(&region);
+    prv_plan_buffers(&region, &m_config, thing_num);
+    size_t size = buff_region_size(&region);
+    return size > default_size ? budget + size - default_size : budget;
+}
+
+/* Buffers for thing_num things, in one region counted in the budget. */
+static int prv_alloc_buffers(int thing_num) {
+    prv_plan_buffers(&m_buffers, &m_config, thing_num);
+    if (mem_pool_reserve("sdk buffers", buff_region_size(&m_buffers)) != 0
+            || buff_region_alloc(&m_buffers) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void print_sock_stats() {
+    sock_cb_stats_t stats;
+    sock_cb_get_stats(&stats);
+    printf("connections: open=%d peak=%d pooled_open=%d pool_waits=%lu "
+            "connects=%lu resumed=%lu failures=%lu\n",
+            stats.open, stats.peak_open, stats.pooled_open, stats.pool_waits,
+            stats.connects, stats.resumed, stats.connect_failures);
+    printf("dns: lookups=%lu hits=%lu\n", stats.dns_lookups, stats.dns_hits);
+}
+
+static void print_cmd_queue_stats() {
+    cmd_queue_stats_t stats;
+    cmd_queue_get_stats(&m_cmd_queue, &stats);
+    printf("command queue: depth=%zu max_depth=%zu enqueued=%lu "
+            "coalesced=%lu rejected=%lu executed=%lu\n",
+            stats.depth, stats.max_depth, stats.enqueued,
+            stats.coalesced, stats.rejected, stats.executed);
+    printf("command latency(us): last=%llu max=%llu avg=%llu\n",
+            (unsigned long long)stats.last_latency_us,
+            (unsigned long long)stats.max_latency_us,
+            stats.executed > 0 ?
+                (unsigned long long)(stats.total_latency_us / stats.executed) :
+                0ULL);
 }
 
 typedef struct {
-    size_t max_size;
+    device_t* device;
+    /* Non 0 if uploads are timed by the upload scheduler of gateway mode,
+     * which wakes the updater delay once per period. */
+    int scheduled;
+    state_encoding_t encoding;
+    /* State encoded by updater_cb_state_size, sent by updater_cb_read. */
+    char payload[STATE_PAYLOAD_SIZE];
+    size_t payload_size;
     size_t read_size;
+    char work[STATE_ENCODING_ZLIB_MEM_SIZE + STATE_PAYLOAD_SIZE];
+    unsigned long uploads;
+    unsigned long long total_bytes;
+    unsigned long long total_cpu_ns;
+    size_t last_bytes;
+    unsigned long last_cpu_ns;
+    /* Trace of the action which triggered the upload in progress. */
+    uint32_t trace_id;
+    uint64_t upload_start_us;
 } updater_context_t;
 
+static unsigned long prv_thread_cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* The whole state is encoded here, as its size must be known before
+ * sending. updater_cb_read sends it in chunks. */
 size_t updater_cb_state_size(void* userdata)
 {
-    char max_size_state[] = "{\"AirConditionerAlias\":{\"power\":false\"currentTemperature\":40}}";
     updater_context_t* ctx = (updater_context_t*)userdata;
-    ctx->max_size = strlen(max_size_state);
     // need to set it to 0, so that when next time updater will continue to send
     ctx->read_size = 0;
-    return ctx->max_size;
-}
+    ctx->payload_size = 0;
+
+    device_t* device = ctx->device;
+    uint64_t start_us = trace_now_us();
+    ctx->trace_id = atomic_exchange(&device->push_trace_id, 0);
+    ctx->upload_start_us = start_us;
+    trace_span(ctx->trace_id, "push_wait", device->push_requested_us, start_us);
 
-size_t updater_cb_read(
-    char *buffer,
-    size_t size,
-    void *userdata)
-{
     prv_air_conditioner_t air_conditioner;
     int length = sizeof(air_conditioner);
     memset(&air_conditioner, 0x00, length);
-    if (prv_get_air_conditioner_info(&air_conditioner) == KII_FALSE) {
-        printf("fail to lock.\n");
+    if (prv_get_air_conditioner_info(device, &air_conditioner) == KII_FALSE) {
+        printf("fail to read state.\n");
+        return 0;
+    }
+    uint64_t read_us = trace_now_us();
+    trace_span(ctx->trace_id, "read_state", start_us, read_us);
+
+    unsigned long start_ns = prv_thread_cpu_ns();
+    state_encoder_t enc;
+    state_encoder_init(
+            &enc,
+            ctx->encoding,
+            ctx->payload,
+            sizeof(ctx->payload),
+            ctx->work,
+            sizeof(ctx->work));
+    state_encoder_begin_map(&enc, NULL);
+    state_encoder_begin_map(&enc, "AirConditionerAlias");
+    if (device->has_led) {
+        state_encoder_put_bool(&enc, "power", air_conditioner.power == KII_TRUE);
+    }
+    if (device->has_sensor) {
+        state_encoder_put_int(&enc, "currentTemperature", air_conditioner.temperature);
+    }
+    state_encoder_end_map(&enc);
+    state_encoder_end_map(&enc);
+    ctx->payload_size = state_encoder_finish(&enc);
+    if (ctx->payload_size == 0) {
+        printf("fail to encode state.\n");
         return 0;
     }
 
-    char state[100];
-    sprintf(
-        state,
-        "{\"AirConditionerAlias\":{\"power\":%s\"currentTemperature\":%d}}",
-        (int)air_conditioner.power == (int)JKII_TRUE ? "true," : "false,",
-        air_conditioner.temperature);
+    ctx->last_cpu_ns = prv_thread_cpu_ns() - start_ns;
+    trace_span(ctx->trace_id, "encode_state", read_us, trace_now_us());
+    ctx->last_bytes = ctx->payload_size;
+    ctx->uploads++;
+    ctx->total_bytes += ctx->payload_size;
+    ctx->total_cpu_ns += ctx->last_cpu_ns;
+    return ctx->payload_size;
+}
 
+size_t updater_cb_read(
+    char *buffer,
+    size_t size,
+    void *userdata)
+{
     updater_context_t* ctx = (updater_context_t*)userdata;
-    size_t read_size = sprintf(buffer, "%.*s", size, &state[ctx->read_size]);
+    size_t read_size = ctx->payload_size - ctx->read_size;
+    if (read_size > size) {
+        read_size = size;
+    }
+    memcpy(buffer, &ctx->payload[ctx->read_size], read_size);
     ctx->read_size += read_size;
     return read_size;
 }
 
+/* The SDK waits here between uploads, so the last upload is done. */
+static void updater_delay_ms_cb(unsigned int msec, void* userdata)
+{
+    updater_context_t* ctx = (updater_context_t*)userdata;
+    if (ctx->trace_id != 0) {
+        trace_span(ctx->trace_id, "upload_state", ctx->upload_start_us,
+                trace_now_us());
+        ctx->trace_id = 0;
+    }
+    if (sock_trace_replay_fast()) {
+        // Upload as soon as the trace allows.
+        return;
+    }
+    if (ctx->scheduled) {
+        // Twice the period in case the scheduler misses a slot.
+        msec *= 2;
+    }
+    wakeable_delay_ms_cb(msec, &ctx->device->updater_delay);
+}
+
+/* The SDK uploads the state with Content-Type: application/json and
+ * without Content-Encoding, and has no option to change them. Other
+ * encodings reach only a backend which ignores these headers. */
+static void prv_check_state_encoding(state_encoding_t encoding, int force)
+{
+    if (encoding == STATE_ENCODING_JSON) {
+        return;
+    }
+    if (!force) {
+        printf("state encoding %s is sent as application/json by the SDK. "
+                "Add --force-state-encoding if the backend accepts it.\n",
+                state_encoding_name(encoding));
+        exit(1);
+    }
+    printf("warning: state encoding %s is sent as application/json.\n",
+            state_encoding_name(encoding));
+}
+
+static void print_updater_stats(const updater_context_t* ctx) {
+    printf("state upload(%s): count=%lu last_bytes=%zu last_cpu_us=%lu "
+            "avg_bytes=%llu avg_cpu_us=%llu\n",
+            state_encoding_name(ctx->encoding),
+            ctx->uploads, ctx->last_bytes, ctx->last_cpu_ns / 1000,
+            ctx->uploads > 0 ? ctx->total_bytes / ctx->uploads : 0ULL,
+            ctx->uploads > 0 ? ctx->total_cpu_ns / ctx->uploads / 1000 : 0ULL);
+}
+
+/* A thing with its own SDK instances and buffers. Onboard mode has one
+ * thing, gateway mode one per probe and one for the LED. */
+typedef struct {
+    char vendor_thing_id[128];
+    /* Empty not to store credentials. */
+    char credential_file[256];
+    kii_author_t author;
+    /* Set if author was loaded from credential_file. A rejected token is
+     * then worth onboarding again. */
+    int author_stored;
+    /* Index of the thing in SDK buffers, see prv_alloc_buffers(). */
+    int index;
+    /* Set while the tasks of the thing run. */
+    bool started;
+    /* trace_now_us() of the next onboarding attempt, and the wait after it
+     * if it fails. */
+    uint64_t onboard_at_us;
+    unsigned int onboard_retry_sec;
+    /* Set to stop the tasks of the thing without stopping the process. */
+    atomic_bool stopping;
+    /* Tasks of the thing which exited, up to TASKS_PER_THING. */
+    atomic_int tasks_exited;
+    device_t device;
+    updater_context_t updater_ctx;
+    tio_updater_t updater;
+    tio_handler_t handler;
+    socket_context_t updater_http_ctx;
+    socket_context_t handler_http_ctx;
+    socket_context_t handler_mqtt_ctx;
+    jkii_resource_t updater_resource;
+    jkii_resource_t handler_resource;
+} thing_t;
+
+/* userdata of the task callbacks is the thing_t of the task. */
+tio_bool_t _handler_continue(void* task_info, void* userdata) {
+    thing_t* thing = (thing_t*)userdata;
+    if (term_flag == true || thing->stopping) {
+        return KII_FALSE;
+    } else {
+        return KII_TRUE;
+    }
+}
+
+tio_bool_t _updater_continue(void* task_info, void* userdata) {
+    thing_t* thing = (thing_t*)userdata;
+    if (term_flag == true || thing->stopping) {
+        return KII_FALSE;
+    } else {
+        return KII_TRUE;
+    }
+}
+
+void _handler_exit(void* task_info, void* userdata) {
+    printf("_handler_exit called\n");
+    ((thing_t*)userdata)->tasks_exited++;
+}
+
+void _updater_exit(void* task_info, void* userdata) {
+    printf("_updater_exit called\n");
+    ((thing_t*)userdata)->tasks_exited++;
+}
+
+/* Socket callbacks which note how much of the SDK buffers is used, so
+ * the sizes recommended in the report are not guessed. */
+static khc_sock_code_t prv_sock_send(
+        void* sock_ctx,
+        const char* buffer,
+        size_t length,
+        size_t* out_sent_length)
+{
+    buff_region_track(&m_buffers, buffer, length);
+    return sock_cb_send(sock_ctx, buffer, length, out_sent_length);
+}
+
+static khc_sock_code_t prv_sock_recv(
+        void* sock_ctx,
+        char* buffer,
+        size_t length_to_read,
+        size_t* out_actual_length)
+{
+    khc_sock_code_t ret =
+        sock_cb_recv(sock_ctx, buffer, length_to_read, out_actual_length);
+    if (ret == KHC_SOCK_OK) {
+        buff_region_track(&m_buffers, buffer, *out_actual_length);
+    }
+    return ret;
+}
+
 tio_bool_t pushed_message_callback(
     const char* message,
     size_t message_length,
@@ -151,11 +634,12 @@ void handler_init(
         char* mqtt_buffer,
         int mqtt_buffer_size,
         void* mqtt_ssl_ctx,
-        jkii_resource_t* resource)
+        jkii_resource_t* resource,
+        void* task_userdata)
 {
     tio_handler_init(handler);
 
-    tio_handler_set_app(handler, KII_APP_ID, KII_APP_HOST);
+    tio_handler_set_app(handler, m_config.app_id, m_config.app_host);
 
     tio_handler_set_cb_push(handler, pushed_message_callback, NULL);
 
@@ -163,65 +647,154 @@ void handler_init(
     tio_handler_set_cb_delay_ms(handler, delay_ms_cb_impl, NULL);
 
     tio_handler_set_cb_sock_connect_http(handler, sock_cb_connect, http_ssl_ctx);
-    tio_handler_set_cb_sock_send_http(handler, sock_cb_send, http_ssl_ctx);
-    tio_handler_set_cb_sock_recv_http(handler, sock_cb_recv, http_ssl_ctx);
+    tio_handler_set_cb_sock_send_http(handler, prv_sock_send, http_ssl_ctx);
+    tio_handler_set_cb_sock_recv_http(handler, prv_sock_recv, http_ssl_ctx);
     tio_handler_set_cb_sock_close_http(handler, sock_cb_close, http_ssl_ctx);
 
     tio_handler_set_cb_sock_connect_mqtt(handler, sock_cb_connect, mqtt_ssl_ctx);
-    tio_handler_set_cb_sock_send_mqtt(handler, sock_cb_send, mqtt_ssl_ctx);
-    tio_handler_set_cb_sock_recv_mqtt(handler, sock_cb_recv, mqtt_ssl_ctx);
+    tio_handler_set_cb_sock_send_mqtt(handler, prv_sock_send, mqtt_ssl_ctx);
+    tio_handler_set_cb_sock_recv_mqtt(handler, prv_sock_recv, mqtt_ssl_ctx);
     tio_handler_set_cb_sock_close_mqtt(handler, sock_cb_close, mqtt_ssl_ctx);
 
-    tio_handler_set_mqtt_to_sock_recv(handler, TO_RECV_SEC);
-    tio_handler_set_mqtt_to_sock_send(handler, TO_SEND_SEC);
+    tio_handler_set_mqtt_to_sock_recv(handler, m_config.recv_timeout_sec);
+    tio_handler_set_mqtt_to_sock_send(handler, m_config.send_timeout_sec);
 
     tio_handler_set_http_buff(handler, http_buffer, http_buffer_size);
     tio_handler_set_mqtt_buff(handler, mqtt_buffer, mqtt_buffer_size);
 
-    tio_handler_set_keep_alive_interval(handler, HANDLER_KEEP_ALIVE_SEC);
+    tio_handler_set_keep_alive_interval(handler, m_config.keep_alive_sec);
 
     tio_handler_set_json_parser_resource(handler, resource);
 
-    tio_handler_set_cb_task_continue(handler, _handler_continue, NULL);
-    tio_handler_set_cb_task_exit(handler, _handler_exit, NULL);
+    tio_handler_set_cb_task_continue(handler, _handler_continue, task_userdata);
+    tio_handler_set_cb_task_exit(handler, _handler_exit, task_userdata);
 }
 
 void updater_init(
         tio_updater_t* updater,
+        updater_context_t* updater_ctx,
         char* buffer,
         int buffer_size,
         void* sock_ssl_ctx,
-        jkii_resource_t* resource)
+        jkii_resource_t* resource,
+        void* task_userdata)
 {
     tio_updater_init(updater);
 
-    tio_updater_set_app(updater, KII_APP_ID, KII_APP_HOST);
+    tio_updater_set_app(updater, m_config.app_id, m_config.app_host);
 
     tio_updater_set_cb_task_create(updater, task_create_cb_impl, NULL);
-    tio_updater_set_cb_delay_ms(updater, delay_ms_cb_impl, NULL);
+    // Waits for update_period_sec, or less if the state is changed.
+    tio_updater_set_cb_delay_ms(updater, updater_delay_ms_cb, updater_ctx);
 
     tio_updater_set_buff(updater, buffer, buffer_size);
 
     tio_updater_set_cb_sock_connect(updater, sock_cb_connect, sock_ssl_ctx);
-    tio_updater_set_cb_sock_send(updater, sock_cb_send, sock_ssl_ctx);
-    tio_updater_set_cb_sock_recv(updater, sock_cb_recv, sock_ssl_ctx);
+    tio_updater_set_cb_sock_send(updater, prv_sock_send, sock_ssl_ctx);
+    tio_updater_set_cb_sock_recv(updater, prv_sock_recv, sock_ssl_ctx);
     tio_updater_set_cb_sock_close(updater, sock_cb_close, sock_ssl_ctx);
 
-    tio_updater_set_interval(updater, UPDATE_PERIOD_SEC);
+    tio_updater_set_interval(updater, m_config.update_period_sec);
 
     tio_updater_set_json_parser_resource(updater, resource);
 
-    tio_updater_set_cb_task_continue(updater, _updater_continue, NULL);
-    tio_updater_set_cb_task_exit(updater, _updater_exit, NULL);
+    tio_updater_set_cb_task_continue(updater, _updater_continue, task_userdata);
+    tio_updater_set_cb_task_exit(updater, _updater_exit, task_userdata);
 }
 
+/* Runs on the command queue worker, off the MQTT receive thread. */
+static void cmd_queue_exec(const cmd_queue_cmd_t* cmd, void* userdata)
+{
+    device_t* device = (device_t*)cmd->target;
+    prv_air_conditioner_t air_conditioner;
+    uint64_t start_us = trace_now_us();
+    trace_span(cmd->trace_id, "queue_wait", cmd->enqueued_us, start_us);
+
+    if (strcmp(cmd->action_name, "turnPower") == 0) {
+        memset(&air_conditioner, 0, sizeof(air_conditioner));
+        air_conditioner.power = cmd->bool_value ? KII_TRUE : KII_FALSE;
+        if (air_conditioner.power == KII_TRUE) {
+            hal_turn_on_led(0, 50, 0);
+        } else {
+            hal_turn_off_led();
+        }
+        uint64_t actuated_us = trace_now_us();
+        trace_span(cmd->trace_id, "actuate", start_us, actuated_us);
+
+        // Set before the change wakes the updater.
+        if (cmd->trace_id != 0) {
+            device->push_requested_us = actuated_us;
+            atomic_store(&device->push_trace_id, cmd->trace_id);
+        }
+        int changed = 0;
+        if (prv_set_air_conditioner_info(device, &air_conditioner, &changed)
+                == KII_FALSE) {
+            printf("fail to set state.\n");
+        }
+        if (cmd->trace_id != 0 && !changed) {
+            // No upload follows, so the next periodic upload must not be
+            // attributed to this command.
+            unsigned int expected = cmd->trace_id;
+            atomic_compare_exchange_strong(&device->push_trace_id, &expected, 0);
+        }
+        trace_span(cmd->trace_id, "update_state", actuated_us, trace_now_us());
+    }
+}
+
+/* Validate an action and queue it. Both cloud and local commands come here.
+ * Returning KII_TRUE means the action is accepted. */
+static tio_bool_t prv_dispatch_action(
+        device_t* device,
+        const char* alias,
+        const char* action_name,
+        tio_bool_t is_bool,
+        tio_bool_t bool_value,
+        uint32_t trace_id,
+        char* err_message,
+        size_t err_message_size)
+{
+    if (strcmp(alias, "AirConditionerAlias") != 0) {
+        snprintf(err_message, err_message_size, "invalid alias");
+        return KII_FALSE;
+    }
+
+    if (strcmp(action_name, "turnPower") == 0) {
+        if (!device->has_led) {
+            snprintf(err_message, err_message_size, "no actuator");
+            return KII_FALSE;
+        }
+        if (is_bool != KII_TRUE) {
+            printf("invalid value.");
+            snprintf(err_message, err_message_size, "invalid value");
+            return KII_FALSE;
+        }
+        cmd_queue_code_t ret = cmd_queue_push(
+                &m_cmd_queue,
+                device,
+                alias,
+                action_name,
+                bool_value == KII_TRUE,
+                trace_id);
+        if (ret != CMD_QUEUE_OK) {
+            printf("fail to queue command.\n");
+            snprintf(err_message, err_message_size, "%s",
+                    ret == CMD_QUEUE_FULL ?
+                    "command queue full" : "command queue stopped");
+            return KII_FALSE;
+        }
+    }
+    return KII_TRUE;
+}
+
+/* Actions are validated here and applied by the command queue worker.
+ * Returning KII_TRUE reports to the cloud that the action is accepted.
+ * userdata is the device_t of the thing which received the action. */
 static tio_bool_t tio_action_handler(
     tio_action_t* action,
     tio_action_err_t* error,
     tio_action_result_data_t* data,
     void* userdata)
 {
-    prv_air_conditioner_t air_conditioner;
     char alias[action->alias_length+1];
     char action_name[action->action_name_length + 1];
     memset(alias, 0, sizeof(alias));
@@ -230,55 +803,905 @@ static tio_bool_t tio_action_handler(
     strncpy(action_name, action->action_name, action->action_name_length);
     printf("%s: %s\n", alias, action_name);
 
-    if (strcmp(alias, "AirConditionerAlias") != 0) {
-        strcpy(error->err_message, "invalid alias");
-        return KII_FALSE;
+    // Span from the first bytes of the message to here covers MQTT receive
+    // and parsing by the SDK.
+    uint64_t start_us = trace_now_us();
+    uint64_t recv_us = trace_recv_start_us();
+    uint32_t trace_id = trace_begin();
+    trace_span(trace_id, "receive_parse", recv_us != 0 ? recv_us : start_us,
+            start_us);
+
+    tio_bool_t ret = prv_dispatch_action(
+            (device_t*)userdata,
+            alias,
+            action_name,
+            action->action_value.type == TIO_TYPE_BOOLEAN ? KII_TRUE : KII_FALSE,
+            action->action_value.param.bool_value,
+            trace_id,
+            error->err_message,
+            sizeof(error->err_message));
+    trace_span(trace_id, "dispatch", start_us, trace_now_us());
+    return ret;
+}
+
+/* userdata is the device_t to control. Requests of local API, one per line:
+ *   state
+ *   action {alias} {action name} {true|false}
+ *   stats
+ *   trace (write spans to the trace file)
+ *   sizing (peak and recommended sizes of buffers)
+ */
+static size_t local_api_request_cb(
+        const char* request,
+        char* response,
+        size_t response_size,
+        void* userdata)
+{
+    char alias[CMD_QUEUE_ALIAS_SIZE];
+    char action_name[CMD_QUEUE_ACTION_NAME_SIZE];
+    char value[8];
+    int len;
+    device_t* device = (device_t*)userdata;
+
+    if (strcmp(request, "state") == 0) {
+        prv_air_conditioner_t air_conditioner;
+        if (prv_get_cached_air_conditioner_info(device, &air_conditioner) == KII_FALSE) {
+            len = snprintf(response, response_size, "{\"error\":\"no state\"}");
+        } else {
+            len = snprintf(
+                response,
+                response_size,
+                "{\"AirConditionerAlias\":{\"power\":%s,\"currentTemperature\":%d}}",
+                air_conditioner.power == KII_TRUE ? "true" : "false",
+                air_conditioner.temperature);
+        }
+    } else if (sscanf(request, "action %63s %63s %7s",
+                alias, action_name, value) == 3) {
+        char err_message[64];
+        tio_bool_t is_bool = KII_TRUE;
+        tio_bool_t bool_value = KII_FALSE;
+        if (strcmp(value, "true") == 0) {
+            bool_value = KII_TRUE;
+        } else if (strcmp(value, "false") != 0) {
+            is_bool = KII_FALSE;
+        }
+        uint64_t start_us = trace_now_us();
+        uint32_t trace_id = trace_begin();
+        tio_bool_t ret = prv_dispatch_action(device, alias, action_name, is_bool,
+                bool_value, trace_id, err_message, sizeof(err_message));
+        trace_span(trace_id, "local_dispatch", start_us, trace_now_us());
+        if (ret == KII_TRUE) {
+            len = snprintf(response, response_size, "{\"result\":\"accepted\"}");
+        } else {
+            len = snprintf(response, response_size, "{\"error\":\"%s\"}",
+                    err_message);
+        }
+    } else if (strcmp(request, "stats") == 0) {
+        cmd_queue_stats_t stats;
+        cmd_queue_get_stats(&m_cmd_queue, &stats);
+        len = snprintf(
+            response,
+            response_size,
+            "{\"queueDepth\":%zu,\"maxQueueDepth\":%zu,\"executed\":%lu,"
+            "\"coalesced\":%lu,\"lastLatencyUs\":%llu,\"maxLatencyUs\":%llu}",
+            stats.depth, stats.max_depth, stats.executed, stats.coalesced,
+            (unsigned long long)stats.last_latency_us,
+            (unsigned long long)stats.max_latency_us);
+    } else if (strcmp(request, "trace") == 0) {
+        long spans = prv_export_trace();
+        if (spans < 0) {
+            len = snprintf(response, response_size, "{\"error\":\"fail to export\"}");
+        } else {
+            len = snprintf(response, response_size,
+                    "{\"file\":\"%s\",\"spans\":%ld}", m_trace_file, spans);
+        }
+    } else if (strcmp(request, "sizing") == 0) {
+        len = buff_region_report_json(&m_buffers, response, response_size);
+    } else {
+        len = snprintf(response, response_size, "{\"error\":\"unknown request\"}");
     }
+    if (len < 0) {
+        return 0;
+    }
+    return (size_t)len < response_size ? (size_t)len : response_size - 1;
+}
 
-    memset(&air_conditioner, 0, sizeof(air_conditioner));
-    if (prv_get_air_conditioner_info(&air_conditioner) == KII_FALSE) {
-        printf("fail to lock.\n");
-        strcpy(error->err_message, "fail to lock.");
-        return KII_FALSE;
+/* SDK instances of the thing, reset to their initial state. */
+static void prv_thing_sdk_init(thing_t* thing)
+{
+    thing->updater_resource.tokens =
+        buff_region_get(&m_buffers, m_updater_tokens, thing->index);
+    thing->updater_resource.tokens_num = m_config.updater_token_num;
+    thing->handler_resource.tokens =
+        buff_region_get(&m_buffers, m_handler_tokens, thing->index);
+    thing->handler_resource.tokens_num = m_config.handler_token_num;
+
+    updater_init(
+            &thing->updater,
+            &thing->updater_ctx,
+            buff_region_get(&m_buffers, m_updater_http_buffs, thing->index),
+            m_config.updater_http_buff_size,
+            &thing->updater_http_ctx,
+            &thing->updater_resource,
+            thing);
+    handler_init(
+            &thing->handler,
+            buff_region_get(&m_buffers, m_handler_http_buffs, thing->index),
+            m_config.handler_http_buff_size,
+            &thing->handler_http_ctx,
+            buff_region_get(&m_buffers, m_handler_mqtt_buffs, thing->index),
+            m_config.handler_mqtt_buff_size,
+            &thing->handler_mqtt_ctx,
+            &thing->handler_resource,
+            thing);
+}
+
+/* thing must be zero filled. Set device fields after this.
+ * credential_file is NULL not to store credentials. */
+static void prv_thing_init(
+        thing_t* thing,
+        int index,
+        const char* vendor_thing_id,
+        const char* credential_file,
+        state_encoding_t encoding)
+{
+    snprintf(thing->vendor_thing_id, sizeof(thing->vendor_thing_id), "%s",
+            vendor_thing_id);
+    if (credential_file != NULL) {
+        snprintf(thing->credential_file, sizeof(thing->credential_file),
+                "%s", credential_file);
     }
-    if (strcmp(action_name, "turnPower") == 0) {
-        if (action->action_value.type == TIO_TYPE_BOOLEAN) {
-            air_conditioner.power = action->action_value.param.bool_value;
-            if (air_conditioner.power == KII_TRUE) {
-                turnOnLED(0, 50, 0);
-            } else {
-                turnOffLED();
+    thing->index = index;
+    thing->onboard_retry_sec = ONBOARD_RETRY_MIN_SEC;
+    atomic_init(&thing->stopping, false);
+    atomic_init(&thing->tasks_exited, 0);
+
+    prv_device_init(&thing->device);
+    state_store_subscribe(
+            &thing->device.store,
+            STATE_FIELD_POWER,
+            prv_push_state_on_change,
+            &thing->device.updater_delay);
+
+    thing->updater_ctx.device = &thing->device;
+    thing->updater_ctx.encoding = encoding;
+
+    socket_context_t* ctxs[] = {
+        &thing->updater_http_ctx,
+        &thing->handler_http_ctx,
+        &thing->handler_mqtt_ctx
+    };
+    for (int i = 0; i < 3; ++i) {
+        ctxs[i]->socket = -1;
+        ctxs[i]->to_recv = m_config.recv_timeout_sec;
+        ctxs[i]->to_send = m_config.send_timeout_sec;
+        // Stream ids in socket traces.
+        ctxs[i]->trace_stream = i;
+    }
+    // HTTP connections are short and share the pool. MQTT stays open.
+    thing->updater_http_ctx.pooled = 1;
+    thing->handler_http_ctx.pooled = 1;
+    // A rejected access token makes the thing onboard again.
+    thing->updater_http_ctx.check_auth = 1;
+    thing->handler_http_ctx.check_auth = 1;
+
+    prv_thing_sdk_init(thing);
+}
+
+/* Reuse stored credentials, or onboard and store them. */
+static int prv_thing_onboard(thing_t* thing, const char* password)
+{
+    if (thing->credential_file[0] != '\0' && cred_store_load(
+                thing->credential_file,
+                m_config.app_id,
+                m_config.app_host,
+                thing->vendor_thing_id,
+                &thing->author) == 0) {
+        printf("%s: reusing stored credentials.\n", thing->vendor_thing_id);
+        thing->author_stored = 1;
+        return 0;
+    }
+    thing->author_stored = 0;
+    tio_code_t result = tio_handler_onboard(
+            &thing->handler,
+            thing->vendor_thing_id,
+            password,
+            NULL,
+            NULL,
+            NULL,
+            NULL);
+    if (result != TIO_ERR_OK) {
+        printf("%s: failed to onboard.\n", thing->vendor_thing_id);
+        return -1;
+    }
+    printf("%s: onboarding succeeded!\n", thing->vendor_thing_id);
+    thing->author = *tio_handler_get_author(&thing->handler);
+    if (thing->credential_file[0] != '\0' && cred_store_save(
+                thing->credential_file,
+                m_config.app_id,
+                m_config.app_host,
+                thing->vendor_thing_id,
+                &thing->author) != 0) {
+        printf("failed to store credentials to %s.\n", thing->credential_file);
+    }
+    return 0;
+}
+
+/* Handler and updater connect in their own tasks, in parallel. */
+static void prv_thing_start(thing_t* thing)
+{
+    thing->stopping = false;
+    thing->tasks_exited = 0;
+    thing->started = true;
+    // Actions are dispatched to the device of the thing.
+    tio_handler_start(&thing->handler, &thing->author,
+            tio_action_handler, &thing->device);
+    tio_updater_start(
+            &thing->updater,
+            &thing->author,
+            updater_cb_state_size,
+            &thing->updater_ctx,
+            updater_cb_read,
+            &thing->updater_ctx);
+}
+
+/* A thing waiting for onboarding has no tasks to wait for on exit. */
+static bool prv_thing_exited(const thing_t* thing)
+{
+    if (!thing->started) {
+        return term_flag;
+    }
+    return thing->tasks_exited >= TASKS_PER_THING;
+}
+
+/* Only a token loaded from the store is renewed. A token just issued by
+ * onboarding is not expected to be rejected. */
+static bool prv_thing_auth_rejected(const thing_t* thing)
+{
+    return thing->author_stored &&
+        (thing->handler_http_ctx.auth_rejected ||
+         thing->updater_http_ctx.auth_rejected);
+}
+
+/* The server rejected the stored access token. Stop the tasks of the
+ * thing and forget its credentials, so that prv_thing_poll() onboards it
+ * again in this process. Other things keep running. */
+static void prv_thing_stop(thing_t* thing)
+{
+    printf("%s: stored credentials are rejected. Onboarding again...\n",
+            thing->vendor_thing_id);
+    thing->stopping = true;
+    delay_wake(&thing->device.updater_delay);
+    while (thing->tasks_exited < TASKS_PER_THING) {
+        usleep(100 * 1000);
+    }
+    thing->started = false;
+    // Connections the tasks left open.
+    sock_cb_close(&thing->updater_http_ctx);
+    sock_cb_close(&thing->handler_http_ctx);
+    sock_cb_close(&thing->handler_mqtt_ctx);
+    thing->updater_http_ctx.auth_rejected = 0;
+    thing->handler_http_ctx.auth_rejected = 0;
+
+    cred_store_remove(thing->credential_file);
+    prv_thing_sdk_init(thing);
+    thing->onboard_at_us = 0;
+}
+
+/* Called periodically from the main loop. Onboards and starts the thing
+ * when it is due, and onboards it again when its stored token is rejected.
+ * Failed onboarding is retried with backoff, so that the process and the
+ * local API keep running while the cloud is unreachable.
+ *
+ * Returns true if the thing is started by this call. */
+static bool prv_thing_poll(thing_t* thing, const char* password)
+{
+    if (term_flag) {
+        return false;
+    }
+    if (thing->started) {
+        if (!prv_thing_auth_rejected(thing)) {
+            return false;
+        }
+        prv_thing_stop(thing);
+    }
+    if (trace_now_us() < thing->onboard_at_us) {
+        return false;
+    }
+    if (prv_thing_onboard(thing, password) != 0) {
+        printf("%s: retrying onboarding in %u sec.\n",
+                thing->vendor_thing_id, thing->onboard_retry_sec);
+        thing->onboard_at_us =
+            trace_now_us() + thing->onboard_retry_sec * 1000000ULL;
+        thing->onboard_retry_sec *= 2;
+        if (thing->onboard_retry_sec > ONBOARD_RETRY_MAX_SEC) {
+            thing->onboard_retry_sec = ONBOARD_RETRY_MAX_SEC;
+        }
+        return false;
+    }
+    thing->onboard_retry_sec = ONBOARD_RETRY_MIN_SEC;
+    prv_thing_start(thing);
+    return true;
+}
+
+static void print_gateway_stats(const thing_t* things, int thing_num) {
+    mem_pool_stats_t mem;
+    struct rusage usage;
+
+    mem_pool_get_stats(&mem);
+    printf("gateway: things=%d bytes_per_thing=%zu tls_arena_per_thing=%zu\n",
+            thing_num,
+            sizeof(thing_t) + buff_region_size(&m_buffers) / thing_num
+            + TASKS_PER_THING * TASK_STACK_SIZE,
+            mem.arena_in_use / thing_num);
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        unsigned long long cpu_us =
+            (unsigned long long)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+            * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+        printf("gateway: cpu_us=%llu cpu_us_per_thing=%llu\n",
+                cpu_us, cpu_us / thing_num);
+    }
+}
+
+static void print_stats(const thing_t* things, int thing_num, bool gateway) {
+    if (gateway) {
+        print_gateway_stats(things, thing_num);
+    }
+    for (int i = 0; i < thing_num; ++i) {
+        printf("%s: ", things[i].vendor_thing_id);
+        print_updater_stats(&things[i].updater_ctx);
+    }
+    print_sock_stats();
+    print_sock_trace_stats();
+    print_cmd_queue_stats();
+    print_memory_stats();
+    buff_region_print_report(&m_buffers);
+}
+
+/* Values of getopt_long() for the options of the sub commands. */
+enum {
+    OPT_HELP,
+    OPT_PASSWORD,
+    OPT_CONFIG,
+    OPT_STATE_ENCODING,
+    OPT_FORCE_STATE_ENCODING,
+    OPT_HAL,
+    OPT_ACTUATOR_LOG,
+    OPT_SIM_TEMPERATURE,
+    OPT_SIM_LATENCY_MS,
+    OPT_SIM_CRC_FAULT_RATE,
+    OPT_SIM_MISSING_FAULT_RATE,
+    OPT_SIM_SEED,
+    OPT_TRACE_SAMPLE,
+    OPT_TRACE_FILE,
+    // onboard
+    OPT_VENDOR_THING_ID,
+    OPT_CREDENTIAL_FILE,
+    OPT_RECORD_TRACE,
+    OPT_REPLAY_TRACE,
+    OPT_REPLAY_FAST,
+    OPT_LOCAL_SOCKET,
+    OPT_LOCAL_PORT,
+    // gateway
+    OPT_VENDOR_THING_ID_PREFIX,
+    OPT_CREDENTIAL_DIR,
+    OPT_MAX_CONNECTIONS,
+    OPT_CONNECT_TO,
+    OPT_SIM_PROBES
+};
+
+/* Options of both sub commands, parsed by prv_parse_common_option(). */
+#define COMMON_OPTIONS \
+    {"help", no_argument, 0, OPT_HELP}, \
+    {"password", required_argument, 0, OPT_PASSWORD}, \
+    {"config", required_argument, 0, OPT_CONFIG}, \
+    {"state-encoding", required_argument, 0, OPT_STATE_ENCODING}, \
+    {"force-state-encoding", no_argument, 0, OPT_FORCE_STATE_ENCODING}, \
+    {"hal", required_argument, 0, OPT_HAL}, \
+    {"actuator-log", required_argument, 0, OPT_ACTUATOR_LOG}, \
+    {"sim-temperature", required_argument, 0, OPT_SIM_TEMPERATURE}, \
+    {"sim-latency-ms", required_argument, 0, OPT_SIM_LATENCY_MS}, \
+    {"sim-crc-fault-rate", required_argument, 0, OPT_SIM_CRC_FAULT_RATE}, \
+    {"sim-missing-fault-rate", required_argument, 0, \
+        OPT_SIM_MISSING_FAULT_RATE}, \
+    {"sim-seed", required_argument, 0, OPT_SIM_SEED}, \
+    {"trace-sample", required_argument, 0, OPT_TRACE_SAMPLE}, \
+    {"trace-file", required_argument, 0, OPT_TRACE_FILE}
+
+typedef struct {
+    const char* password;
+    state_encoding_t encoding;
+    int force_encoding;
+    const char* hal_name;
+    const char* actuator_log;
+    hal_sim_config_t sim_config;
+} common_options_t;
+
+static void prv_common_options_init(common_options_t* options)
+{
+    memset(options, 0x00, sizeof(*options));
+    options->encoding = STATE_ENCODING_JSON;
+    options->hal_name = HAL_DEFAULT_BACKEND;
+}
+
+/* Returns false if c is not one of COMMON_OPTIONS, or is --help. */
+static bool prv_parse_common_option(int c, const char* arg,
+        common_options_t* options)
+{
+    switch(c) {
+        case OPT_PASSWORD:
+            options->password = arg;
+            break;
+        case OPT_CONFIG:
+            // Already read by main.
+            break;
+        case OPT_STATE_ENCODING:
+            if (state_encoding_parse(arg, &options->encoding) != 0) {
+                printf("unknown state encoding: %s\n", arg);
+                exit(1);
             }
+            break;
+        case OPT_FORCE_STATE_ENCODING:
+            options->force_encoding = 1;
+            break;
+        case OPT_HAL:
+            options->hal_name = arg;
+            break;
+        case OPT_ACTUATOR_LOG:
+            options->actuator_log = arg;
+            break;
+        case OPT_SIM_TEMPERATURE:
+            options->sim_config.temperature_curve = arg;
+            break;
+        case OPT_SIM_LATENCY_MS:
+            options->sim_config.latency_ms = (unsigned int)atoi(arg);
+            break;
+        case OPT_SIM_CRC_FAULT_RATE:
+            options->sim_config.crc_fault_rate = atof(arg);
+            break;
+        case OPT_SIM_MISSING_FAULT_RATE:
+            options->sim_config.missing_fault_rate = atof(arg);
+            break;
+        case OPT_SIM_SEED:
+            options->sim_config.seed = (unsigned int)atoi(arg);
+            break;
+        case OPT_TRACE_SAMPLE:
+            trace_set_sample_rate((unsigned int)atoi(arg));
+            break;
+        case OPT_TRACE_FILE:
+            m_trace_file = arg;
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+static void print_common_help() {
+    printf("optional: --config={config file} (default: %s)\n", CONFIG_FILE_PATH);
+    printf("optional: --state-encoding={json|deflate|cbor} (default: json) [--force-state-encoding]\n");
+    printf("optional: --hal={pi|sim} (default: %s)\n", HAL_DEFAULT_BACKEND);
+    printf("optional: --actuator-log={file to log LED changes, - for stdout}\n");
+    printf("optional for sim: --sim-temperature={sec:celsius,...} --sim-latency-ms={ms}\n");
+    printf("  --sim-crc-fault-rate={0.0~1.0} --sim-missing-fault-rate={0.0~1.0} --sim-seed={seed}\n");
+    printf("optional: --trace-sample={trace 1 of N commands, 0 for none} (default: %d)\n",
+            TRACE_DEFAULT_SAMPLE_RATE);
+    printf("optional: --trace-file={file to export traces to} (default: %s)\n",
+            TRACE_EXPORT_PATH);
+}
+
+/* Checks the encoding and initializes the HAL. Exits on failure. */
+static void prv_common_setup(common_options_t* options)
+{
+    prv_check_state_encoding(options->encoding, options->force_encoding);
+
+    FILE* actuatorLogFile = NULL;
+    if (options->actuator_log != NULL) {
+        actuatorLogFile = strcmp(options->actuator_log, "-") == 0 ?
+            stdout : fopen(options->actuator_log, "a");
+        if (actuatorLogFile == NULL) {
+            printf("failed to open %s.\n", options->actuator_log);
+            exit(1);
+        }
+    }
+    if ((strcmp(options->hal_name, "sim") == 0
+                && hal_sim_configure(&options->sim_config) != 0)
+            || hal_init(options->hal_name, actuatorLogFile) != 0) {
+        printf("failed to init hal.\n");
+        exit(1);
+    }
+}
+
+/* Onboards and runs the things until SIGINT, or the end of the replayed
+ * trace, and all their tasks exit. In the gateway, things are started
+ * GATEWAY_START_STAGGER_MS apart. */
+static void prv_run_things(thing_t* things, int thing_num,
+        const char* password, bool gateway)
+{
+    bool end = false;
+    bool disp_msg = false;
+    unsigned int elapsed_sec = 0;
+    while(!end){
+        sleep(1);
+        if (++elapsed_sec == prv_warmup_sec()) {
+            mem_pool_mark_warm();
+        }
+        if (stats_requested) {
+            stats_requested = false;
+            print_stats(things, thing_num, gateway);
+        }
+        if (trace_export_requested) {
+            trace_export_requested = false;
+            long spans = prv_export_trace();
+            if (spans >= 0) {
+                printf("%ld spans are written to %s\n", spans, m_trace_file);
+            }
+        }
+        if (sock_trace_replay_done()) {
+            term_flag = true;
+        }
+        if (term_flag && !disp_msg) {
+            printf("Waiting for exiting tasks...\n");
+            disp_msg = true;
+            // Let updaters waiting for their slot see term_flag.
+            for (int i = 0; i < thing_num; ++i) {
+                delay_wake(&things[i].device.updater_delay);
+            }
+        }
+        end = true;
+        for (int i = 0; i < thing_num; ++i) {
+            if (prv_thing_poll(&things[i], password) && gateway) {
+                usleep(GATEWAY_START_STAGGER_MS * 1000);
+            }
+            if (!prv_thing_exited(&things[i])) {
+                end = false;
+            }
+        }
+    };
+}
+
+static void print_onboard_help() {
+    printf("usage: \n");
+    printf("onboard --vendor-thing-id={ID of the thing} --password={password of the thing}\n");
+    printf("optional: --credential-file={file to store credentials} (default: %s)\n",
+            CREDENTIAL_FILE_PATH);
+    printf("optional: --record-trace={file to record socket traffic}\n");
+    printf("optional: --replay-trace={file to replay socket traffic from} [--replay-fast]\n");
+    printf("optional: --local-socket={path of local API socket, empty to disable} (default: %s)\n",
+            LOCAL_API_SOCKET_PATH);
+    printf("optional: --local-port={port of local API on 127.0.0.1}\n");
+    print_common_help();
+}
+
+/* Onboard one thing with the sensor and the LED. */
+static int onboard_main(int argc, char** argv)
+{
+    const char* vendorThingID = NULL;
+    const char* credentialFile = CREDENTIAL_FILE_PATH;
+    const char* recordTrace = NULL;
+    const char* localSocket = LOCAL_API_SOCKET_PATH;
+    unsigned short localPort = 0;
+    const char* replayTrace = NULL;
+    int replayRealtime = 1;
+    common_options_t options;
+    prv_common_options_init(&options);
+    prv_sampler_t sampler;
+
+    struct option longOptions[] = {
+        COMMON_OPTIONS,
+        {"vendor-thing-id", required_argument, 0, OPT_VENDOR_THING_ID},
+        {"credential-file", required_argument, 0, OPT_CREDENTIAL_FILE},
+        {"record-trace", required_argument, 0, OPT_RECORD_TRACE},
+        {"replay-trace", required_argument, 0, OPT_REPLAY_TRACE},
+        {"replay-fast", no_argument, 0, OPT_REPLAY_FAST},
+        {"local-socket", required_argument, 0, OPT_LOCAL_SOCKET},
+        {"local-port", required_argument, 0, OPT_LOCAL_PORT},
+        {0, 0, 0, 0}
+    };
+    int c;
+    int optIndex = 0;
+    while ((c = getopt_long(argc, argv, "", longOptions, &optIndex)) != -1) {
+        printf("option %s : %s\n", longOptions[optIndex].name, optarg);
+        if (prv_parse_common_option(c, optarg, &options)) {
+            continue;
+        }
+        switch(c) {
+            case OPT_HELP:
+                print_onboard_help();
+                exit(0);
+            case OPT_VENDOR_THING_ID:
+                vendorThingID = optarg;
+                break;
+            case OPT_CREDENTIAL_FILE:
+                credentialFile = optarg;
+                break;
+            case OPT_RECORD_TRACE:
+                recordTrace = optarg;
+                break;
+            case OPT_REPLAY_TRACE:
+                replayTrace = optarg;
+                break;
+            case OPT_REPLAY_FAST:
+                replayRealtime = 0;
+                break;
+            case OPT_LOCAL_SOCKET:
+                localSocket = optarg[0] != '\0' ? optarg : NULL;
+                break;
+            case OPT_LOCAL_PORT:
+                localPort = (unsigned short)atoi(optarg);
+                break;
+            default:
+                printf("unexpected usage.\n");
+        }
+    }
+    if (vendorThingID == NULL) {
+        printf("neither vendor-thing-id is specified.\n");
+        exit(1);
+    }
+    if (options.password == NULL) {
+        printf("password is not specifeid.\n");
+        exit(1);
+    }
+    prv_common_setup(&options);
+
+    // Usage errors are reported before memory is set up from the config.
+    if (prv_memory_init(prv_memory_budget(MEMORY_BUDGET_BYTES, 1),
+                TLS_CONNECTIONS) != 0) {
+        exit(1);
+    }
+    if (prv_alloc_buffers(1) != 0) {
+        printf("failed to set up memory\n");
+        mem_pool_print_budget();
+        exit(1);
+    }
+    mem_pool_print_budget();
+
+    if (cmd_queue_start(&m_cmd_queue, cmd_queue_exec, NULL) != 0) {
+        printf("failed to start command queue\n");
+        exit(1);
+    }
+
+    thing_t* thing = NULL;
+    if (mem_pool_reserve("thing", sizeof(thing_t)) != 0
+            || (thing = calloc(1, sizeof(thing_t))) == NULL) {
+        printf("failed to allocate thing.\n");
+        exit(1);
+    }
+
+    if (replayTrace != NULL) {
+        // Replay from onboarding, as recorded.
+        credentialFile = NULL;
+    }
+    prv_thing_init(thing, 0, vendorThingID, credentialFile, options.encoding);
+    thing->device.has_sensor = 1;
+    thing->device.has_led = 1;
+    // Local API works without the cloud, so start it first.
+    if ((localSocket != NULL || localPort != 0)
+            && local_api_start(
+                &m_local_api,
+                localSocket,
+                localPort,
+                local_api_request_cb,
+                &thing->device) != 0) {
+        printf("local API is not available.\n");
+        localSocket = NULL;
+        localPort = 0;
+    }
+    if ((localSocket != NULL || localPort != 0)
+            && prv_sampler_start(&sampler, &thing->device) != 0) {
+        printf("failed to start sampler.\n");
+        exit(1);
+    }
+    if (recordTrace != NULL && sock_trace_record_open(recordTrace) != 0) {
+        exit(1);
+    }
+    if (replayTrace != NULL
+            && sock_trace_replay_open(replayTrace, replayRealtime) != 0) {
+        exit(1);
+    }
+
+    prv_run_things(thing, 1, options.password, false);
+    if (localSocket != NULL || localPort != 0) {
+        local_api_stop(&m_local_api);
+        prv_sampler_stop(&sampler);
+    }
+    cmd_queue_stop(&m_cmd_queue);
+    print_stats(thing, 1, false);
+    sock_trace_close();
+    return 0;
+}
+
+static void print_gateway_help() {
+    printf("usage: \n");
+    printf("gateway --vendor-thing-id-prefix={prefix of vendor thing ids} --password={password of things}\n");
+    printf("  Each temperature probe and the LED is onboarded as thing {prefix}-{probe id} and {prefix}-led.\n");
+    printf("optional: --credential-dir={directory to store credentials, empty not to store} (default: %s)\n",
+            GATEWAY_CREDENTIAL_DIR);
+    printf("optional: --max-connections={HTTP connections open at once} (default: %d)\n",
+            GATEWAY_MAX_HTTP_CONNECTIONS);
+    printf("optional: --connect-to={host:port to connect to instead of the server, e.g. a mock server}\n");
+    printf("optional for sim: --sim-probes={number of probes}\n");
+    print_common_help();
+}
+
+/* Bridge all probes and the LED as things through one process. Things share
+ * the resolver, TLS context, HTTP connection pool, command queue and upload
+ * timer. */
+static int gateway_main(int argc, char** argv)
+{
+    const char* prefix = NULL;
+    const char* credentialDir = GATEWAY_CREDENTIAL_DIR;
+    char connectToHost[256];
+    common_options_t options;
+    prv_common_options_init(&options);
+    sock_cb_config_t sockConfig;
+    memset(&sockConfig, 0x00, sizeof(sockConfig));
+    sockConfig.max_pooled_connections = GATEWAY_MAX_HTTP_CONNECTIONS;
+    // Most of the connections are idle MQTT connections.
+    sockConfig.release_buffers = 1;
+
+    struct option longOptions[] = {
+        COMMON_OPTIONS,
+        {"vendor-thing-id-prefix", required_argument, 0,
+            OPT_VENDOR_THING_ID_PREFIX},
+        {"credential-dir", required_argument, 0, OPT_CREDENTIAL_DIR},
+        {"max-connections", required_argument, 0, OPT_MAX_CONNECTIONS},
+        {"connect-to", required_argument, 0, OPT_CONNECT_TO},
+        {"sim-probes", required_argument, 0, OPT_SIM_PROBES},
+        {0, 0, 0, 0}
+    };
+    int c;
+    int optIndex = 0;
+    while ((c = getopt_long(argc, argv, "", longOptions, &optIndex)) != -1) {
+        char* colon;
+        printf("option %s : %s\n", longOptions[optIndex].name, optarg);
+        if (prv_parse_common_option(c, optarg, &options)) {
+            continue;
+        }
+        switch(c) {
+            case OPT_HELP:
+                print_gateway_help();
+                exit(0);
+            case OPT_VENDOR_THING_ID_PREFIX:
+                prefix = optarg;
+                break;
+            case OPT_CREDENTIAL_DIR:
+                credentialDir = optarg[0] != '\0' ? optarg : NULL;
+                break;
+            case OPT_MAX_CONNECTIONS:
+                sockConfig.max_pooled_connections = atoi(optarg);
+                break;
+            case OPT_CONNECT_TO:
+                colon = strrchr(optarg, ':');
+                if (colon == NULL || colon == optarg
+                        || (size_t)(colon - optarg) >= sizeof(connectToHost)) {
+                    printf("invalid connect-to: %s\n", optarg);
+                    exit(1);
+                }
+                memcpy(connectToHost, optarg, colon - optarg);
+                connectToHost[colon - optarg] = '\0';
+                sockConfig.connect_to_host = connectToHost;
+                sockConfig.connect_to_port = (unsigned int)atoi(colon + 1);
+                break;
+            case OPT_SIM_PROBES:
+                options.sim_config.probe_num = (unsigned int)atoi(optarg);
+                break;
+            default:
+                printf("unexpected usage.\n");
+        }
+    }
+    if (prefix == NULL || options.password == NULL) {
+        printf("vendor-thing-id-prefix and password are required.\n");
+        print_gateway_help();
+        exit(1);
+    }
+    prv_common_setup(&options);
+
+    // One thing per probe, and one for the LED.
+    char probeIds[GATEWAY_MAX_THINGS - 1][HAL_PROBE_ID_SIZE];
+    int probeNum = hal_list_probes(probeIds, GATEWAY_MAX_THINGS - 1);
+    int thingNum = probeNum + 1;
+    printf("%d probes found.\n", probeNum);
+
+    // An MQTT connection per thing, and the pooled HTTP connections.
+    if (prv_memory_init(
+                prv_memory_budget(GATEWAY_MEMORY_BUDGET_BYTES, thingNum),
+                thingNum + sockConfig.max_pooled_connections) != 0) {
+        exit(1);
+    }
+    size_t extraStacks = thingNum * TASKS_PER_THING > TASK_STACK_NUM ?
+        thingNum * TASKS_PER_THING - TASK_STACK_NUM : 0;
+    if (mem_pool_reserve("gateway things",
+                sizeof(thing_t) * thingNum) != 0
+            || mem_pool_reserve("more stacks",
+                extraStacks * TASK_STACK_SIZE) != 0
+            || prv_alloc_buffers(thingNum) != 0) {
+        printf("failed to set up memory\n");
+        mem_pool_print_budget();
+        exit(1);
+    }
+    mem_pool_print_budget();
+
+    thing_t* things = calloc(thingNum, sizeof(thing_t));
+    if (things == NULL) {
+        printf("failed to allocate things.\n");
+        exit(1);
+    }
+    for (int i = 0; i < thingNum; ++i) {
+        const char* name = i < probeNum ? probeIds[i] : "led";
+        char vendorThingId[sizeof(things[i].vendor_thing_id)];
+        char credentialFile[sizeof(things[i].credential_file)];
+        snprintf(vendorThingId, sizeof(vendorThingId), "%s-%s", prefix, name);
+        snprintf(credentialFile, sizeof(credentialFile), "%s/%s",
+                credentialDir != NULL ? credentialDir : "", vendorThingId);
+        prv_thing_init(&things[i], i, vendorThingId,
+                credentialDir != NULL ? credentialFile : NULL,
+                options.encoding);
+        things[i].updater_ctx.scheduled = 1;
+        if (i < probeNum) {
+            things[i].device.has_sensor = 1;
+            strcpy(things[i].device.probe_id, probeIds[i]);
         } else {
-            printf("invalid value.");
-            strcpy(error->err_message, "invalid value");
-            return KII_FALSE;
+            things[i].device.has_led = 1;
         }
+    }
 
+    sock_cb_configure(&sockConfig);
+    if (cmd_queue_start(&m_cmd_queue, cmd_queue_exec, NULL) != 0) {
+        printf("failed to start command queue\n");
+        exit(1);
     }
 
-    if (prv_set_air_conditioner_info(&air_conditioner) == KII_FALSE) {
-        printf("fail to unlock.\n");
-        return KII_FALSE;
+    upload_scheduler_t scheduler;
+    upload_scheduler_init(&scheduler, m_config.update_period_sec * 1000);
+    for (int i = 0; i < thingNum; ++i) {
+        upload_scheduler_add(&scheduler, &things[i].device.updater_delay);
     }
-    return KII_TRUE;
+    if (upload_scheduler_start(&scheduler) != 0) {
+        printf("failed to start upload scheduler\n");
+        exit(1);
+    }
+
+    prv_run_things(things, thingNum, options.password, true);
+    upload_scheduler_stop(&scheduler);
+    cmd_queue_stop(&m_cmd_queue);
+    print_stats(things, thingNum, true);
+    return 0;
 }
 
 static void print_help() {
-    printf("sub commands: [onboard|update]\n\n");
+    printf("sub commands: [onboard|gateway]\n\n");
     printf("to see detail usage of sub command, execute ./exampleapp {subcommand} --help\n\n");
 
     printf("onboard with vendor-thing-id\n");
     printf("./exampleapp onboard --vendor-thing-id={vendor thing id} --password={password}\n\n");
+
+    printf("bridge all probes and the LED as things\n");
+    printf("./exampleapp gateway --vendor-thing-id-prefix={prefix} --password={password}\n\n");
 }
 
 int main(int argc, char** argv)
 {
-    // setting up wiringPi
-    initLEDPins();
-
     char* subc = argv[1];
 
+    if (argc < 2) {
+        printf("too few arguments.\n");
+        print_help();
+        exit(1);
+    }
+
+    prv_config_init(&m_config);
+    const char* configFile = prv_config_path(argc, argv);
+    int configRet = app_config_load(
+            configFile != NULL ? configFile : CONFIG_FILE_PATH, &m_config);
+    // The default file is optional.
+    if (configRet < 0 || (configRet > 0 && configFile != NULL)) {
+        printf("failed to load config %s.\n",
+                configFile != NULL ? configFile : CONFIG_FILE_PATH);
+        exit(1);
+    }
+    app_config_print(&m_config);
+
     // Setup Signal handler. (Ctrl-C)
     struct sigaction sa_sigint;
     memset(&sa_sigint, 0, sizeof(sa_sigint));
@@ -290,144 +1713,38 @@ int main(int argc, char** argv)
         exit(1);
     }
 
-    tio_updater_t updater;
-    updater_context_t updater_ctx;
-
-    socket_context_t updater_http_ctx;
-    updater_http_ctx.to_recv = TO_RECV_SEC;
-    updater_http_ctx.to_send = TO_SEND_SEC;
-
-    jkii_token_t updater_tokens[256];
-    jkii_resource_t updater_resource = {updater_tokens, 256};
+    // Dump command queue statistics. (kill -USR1)
+    struct sigaction sa_sigusr1;
+    memset(&sa_sigusr1, 0, sizeof(sa_sigusr1));
+    sa_sigusr1.sa_sigaction = stats_sig_handler;
+    sa_sigusr1.sa_flags = SA_SIGINFO;
 
-    char updater_buff[UPDATER_HTTP_BUFF_SIZE];
-    memset(updater_buff, 0x00, sizeof(char) * UPDATER_HTTP_BUFF_SIZE);
-    updater_init(
-            &updater,
-            updater_buff,
-            UPDATER_HTTP_BUFF_SIZE,
-            &updater_http_ctx,
-            &updater_resource);
-
-    tio_handler_t handler;
-
-    socket_context_t handler_http_ctx;
-    handler_http_ctx.to_recv = TO_RECV_SEC;
-    handler_http_ctx.to_send = TO_SEND_SEC;
-
-    socket_context_t handler_mqtt_ctx;
-    handler_mqtt_ctx.to_recv = TO_RECV_SEC;
-    handler_mqtt_ctx.to_send = TO_SEND_SEC;
-
-    char handler_http_buff[HANDLER_HTTP_BUFF_SIZE];
-    memset(handler_http_buff, 0x00, sizeof(char) * HANDLER_HTTP_BUFF_SIZE);
-
-    char handler_mqtt_buff[HANDLER_MQTT_BUFF_SIZE];
-    memset(handler_mqtt_buff, 0x00, sizeof(char) * HANDLER_MQTT_BUFF_SIZE);
-
-    jkii_token_t handler_tokens[256];
-    jkii_resource_t handler_resource = {handler_tokens, 256};
+    if (sigaction(SIGUSR1, &sa_sigusr1, NULL) < 0) {
+        printf("failed to register sigaction\n");
+        exit(1);
+    }
 
-    handler_init(
-            &handler,
-            handler_http_buff,
-            HANDLER_HTTP_BUFF_SIZE,
-            &handler_http_ctx,
-            handler_mqtt_buff,
-            HANDLER_MQTT_BUFF_SIZE,
-            &handler_mqtt_ctx,
-            &handler_resource);
+    // Export trace spans. (kill -USR2)
+    struct sigaction sa_sigusr2;
+    memset(&sa_sigusr2, 0, sizeof(sa_sigusr2));
+    sa_sigusr2.sa_sigaction = trace_sig_handler;
+    sa_sigusr2.sa_flags = SA_SIGINFO;
 
-    if (argc < 2) {
-        printf("too few arguments.\n");
-        print_help();
+    if (sigaction(SIGUSR2, &sa_sigusr2, NULL) < 0) {
+        printf("failed to register sigaction\n");
         exit(1);
     }
+    trace_set_sample_rate(TRACE_DEFAULT_SAMPLE_RATE);
 
     /* Parse command. */
     if (strcmp(subc, "onboard") == 0) {
-        char* vendorThingID = NULL;
-        char* password = NULL;
-        while(1) {
-            struct option longOptions[] = {
-                {"vendor-thing-id", required_argument, 0, 0},
-                {"password", required_argument, 0, 1},
-                {"help", no_argument, 0, 2},
-                {0, 0, 0, 0}
-            };
-            int optIndex = 0;
-            int c = getopt_long(argc, argv, "", longOptions, &optIndex);
-            const char* optName = longOptions[optIndex].name;
-            if (c == -1) {
-                if (vendorThingID == NULL) {
-                    printf("neither vendor-thing-id is specified.\n");
-                    exit(1);
-                }
-                if (password == NULL) {
-                    printf("password is not specifeid.\n");
-                    exit(1);
-                }
-                tio_code_t result = tio_handler_onboard(
-                        &handler,
-                        vendorThingID,
-                        password,
-                        NULL,
-                        NULL,
-                        NULL,
-                        NULL);
-                if (result != TIO_ERR_OK) {
-                    printf("failed to onboard.\n");
-                    exit(1);
-                }
-                printf("Onboarding succeeded!\n");
-                break;
-            }
-            printf("option %s : %s\n", optName, optarg);
-            switch(c) {
-                case 0:
-                    vendorThingID = optarg;
-                    break;
-                case 1:
-                    password = optarg;
-                    break;
-                case 2:
-                    printf("usage: \n");
-                    printf("onboard --vendor-thing-id={ID of the thing} --password={password of the thing}\n");
-                    break;
-                default:
-                    printf("unexpected usage.\n");
-            }
-            if (strcmp(optName, "help") == 0) {
-                exit(0);
-            }
-        }
-    } else {
-        print_help();
-        exit(0);
+        return onboard_main(argc, argv);
+    } else if (strcmp(subc, "gateway") == 0) {
+        // Memory is set up when the number of things is known.
+        return gateway_main(argc, argv);
     }
-
-    const kii_author_t* author = tio_handler_get_author(&handler);
-    tio_handler_start(&handler, author, tio_action_handler, NULL);
-    tio_updater_start(
-            &updater,
-            author,
-            updater_cb_state_size,
-            &updater_ctx,
-            updater_cb_read,
-            &updater_ctx);
-
-    bool end = false;
-    bool disp_msg = false;
-    while(!end){
-        sleep(1);
-        if (term_flag && !disp_msg) {
-            printf("Waiting for exiting tasks...\n");
-            disp_msg = true;
-        }
-        if (handler_terminated && updater_terminated) {
-            end = true;
-        }
-    };
+    print_help();
+    exit(0);
 }
 
-/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
\ No newline at end of file
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
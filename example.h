@@ -5,6 +5,10 @@
 extern 'C' {
 #endif
 
+/* Settings in this file are defaults. Values in CONFIG_FILE_PATH override
+ * them at startup, see app_config.h */
+#define CONFIG_FILE_PATH "/etc/thing-if-pi-sample.conf"
+
 /* Go to https:/developer.kii.com and create app for you! */
 const char KII_APP_ID[] = "rr7oqyvzaonp";
 /* JP: "api-jp.kii.com" */
@@ -16,13 +20,74 @@ const char KII_APP_HOST[] = "api-jp.kii.com";
 #define HANDLER_HTTP_BUFF_SIZE 1024
 #define HANDLER_MQTT_BUFF_SIZE 1024
 #define HANDLER_KEEP_ALIVE_SEC 300
+/* JSON tokens to parse a message. */
+#define HANDLER_TOKEN_NUM 256
 
 #define UPDATER_HTTP_BUFF_SIZE 1024
+#define UPDATER_TOKEN_NUM 256
 #define UPDATE_PERIOD_SEC 60
+/* State changed by an action is uploaded after this quiet period,
+ * without waiting for UPDATE_PERIOD_SEC. */
+#define STATE_PUSH_DEBOUNCE_MS 200
+/* Max size of encoded state. */
+#define STATE_PAYLOAD_SIZE 1024
 
 #define TO_RECV_SEC 15
 #define TO_SEND_SEC 15
 
+/* Author obtained by onboarding is stored here and reused on restart. */
+#define CREDENTIAL_FILE_PATH "/var/lib/thing-if-pi-sample/credentials"
+
+/* Backend of LED and temperature sensor: "pi" or "sim". */
+#ifdef NO_WIRINGPI
+#define HAL_DEFAULT_BACKEND "sim"
+#else
+#define HAL_DEFAULT_BACKEND "pi"
+#endif
+
+/* Onboarding which fails is retried after ONBOARD_RETRY_MIN_SEC, then
+ * twice as long each time up to ONBOARD_RETRY_MAX_SEC. */
+#define ONBOARD_RETRY_MIN_SEC 5
+#define ONBOARD_RETRY_MAX_SEC 300
+
+/* UNIX domain socket of local control API. */
+#define LOCAL_API_SOCKET_PATH "/run/thing-if-pi-sample.sock"
+/* The sensor is read at least this often while the local API runs, also
+ * when the state is not uploaded. */
+#define LOCAL_SAMPLE_PERIOD_SEC 10
+
+/* Trace 1 of N commands from receipt to state upload. 0 disables. */
+#define TRACE_DEFAULT_SAMPLE_RATE 1
+/* Traces are written here on SIGUSR2 or "trace" request of local API.
+ * The directory is created with mode 0700, the file with mode 0600. */
+#define TRACE_EXPORT_PATH "/run/thing-if-pi-sample/trace.json"
+
+/* TLS connections open at once: HTTP and MQTT of handler, HTTP of
+ * updater. Sizes the OpenSSL arena, see MEM_POOL_CLASSES. */
+#define TLS_CONNECTIONS 3
+/* Tasks the SDK creates for a thing: one for handler, one for updater. */
+#define TASKS_PER_THING 2
+
+/* Gateway mode: each temperature probe and the LED is onboarded as a thing
+ * of its own, "{prefix}-{probe id}" and "{prefix}-led". */
+#define GATEWAY_MAX_THINGS 32
+/* Credentials of things are stored here, one file per vendor-thing-id. */
+#define GATEWAY_CREDENTIAL_DIR "/var/lib/thing-if-pi-sample-gateway"
+/* HTTP connections open at once, shared by all things. MQTT connections
+ * stay open, one per thing. */
+#define GATEWAY_MAX_HTTP_CONNECTIONS 4
+/* Things are started this far apart, so that they do not connect at once. */
+#define GATEWAY_START_STAGGER_MS 200
+/* Memory reserved at startup in gateway mode must fit in this. The OpenSSL
+ * arena alone takes about 440KB per thing and per HTTP connection. */
+#define GATEWAY_MEMORY_BUDGET_BYTES (32 * 1024 * 1024)
+
+/* Memory reserved at startup must fit in this. No heap allocation is
+ * expected after the first update period and receive timeout. Both budgets
+ * fit the buffer sizes above, and grow by what larger buffers in the config
+ * file take, unless memory_budget is set there. */
+#define MEMORY_BUDGET_BYTES (2 * 1024 * 1024)
+
 
 #ifdef __cplusplus
 }
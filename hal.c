@@ -0,0 +1,119 @@
+#include "hal.h"
+#include "pi_control.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+static const hal_backend_t* m_backend = NULL;
+static FILE* m_actuator_log = NULL;
+static pthread_mutex_t m_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef NO_WIRINGPI
+static int prv_pi_init(void)
+{
+    printf("built without wiringPi. use --hal=sim.\n");
+    return -1;
+}
+
+static void prv_pi_set_led(int red, int green, int blue)
+{
+}
+#else
+static int prv_pi_init(void)
+{
+    initLEDPins();
+    return 0;
+}
+
+static void prv_pi_set_led(int red, int green, int blue)
+{
+    if (red == 0 && green == 0 && blue == 0) {
+        turnOffLED();
+    } else {
+        turnOnLED(red, green, blue);
+    }
+}
+#endif
+
+static int prv_pi_list_probes(char* ids, int max)
+{
+    return listDS18B20(ids, HAL_PROBE_ID_SIZE, max);
+}
+
+const hal_backend_t hal_pi_backend = {
+    "pi",
+    prv_pi_init,
+    prv_pi_set_led,
+    readDS18B20Temparature,
+    prv_pi_list_probes,
+    readDS18B20TemparatureOf
+};
+
+static const hal_backend_t* m_backends[] = {
+    &hal_pi_backend,
+    &hal_sim_backend
+};
+
+int hal_init(const char* name, FILE* actuator_log)
+{
+    for (size_t i = 0; i < sizeof(m_backends) / sizeof(m_backends[0]); ++i) {
+        if (strcmp(m_backends[i]->name, name) == 0) {
+            if (m_backends[i]->init() != 0) {
+                return -1;
+            }
+            m_backend = m_backends[i];
+            m_actuator_log = actuator_log;
+            return 0;
+        }
+    }
+    printf("unknown hal backend: %s\n", name);
+    return -1;
+}
+
+const char* hal_backend_name()
+{
+    return m_backend != NULL ? m_backend->name : "none";
+}
+
+static void prv_set_led(int red, int green, int blue)
+{
+    m_backend->set_led(red, green, blue);
+    if (m_actuator_log != NULL) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        pthread_mutex_lock(&m_log_mutex);
+        fprintf(m_actuator_log, "%ld.%03ld %s led %d %d %d\n",
+                (long)ts.tv_sec, ts.tv_nsec / 1000000, m_backend->name,
+                red, green, blue);
+        fflush(m_actuator_log);
+        pthread_mutex_unlock(&m_log_mutex);
+    }
+}
+
+void hal_turn_on_led(int red, int green, int blue)
+{
+    prv_set_led(red, green, blue);
+}
+
+void hal_turn_off_led()
+{
+    prv_set_led(0, 0, 0);
+}
+
+int hal_read_temperature()
+{
+    return m_backend->read_temperature();
+}
+
+int hal_list_probes(char ids[][HAL_PROBE_ID_SIZE], int max)
+{
+    return m_backend->list_probes(&ids[0][0], max);
+}
+
+int hal_read_probe_temperature(const char* probe_id)
+{
+    return m_backend->read_probe_temperature(probe_id);
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,89 @@
+#ifndef __HAL
+#define __HAL
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Error codes of hal_read_temperature(), same as readDS18B20Temparature(). */
+#define HAL_TEMP_ERR_NO_DEVICE -9999
+#define HAL_TEMP_ERR_READ -9998
+#define HAL_TEMP_ERR_CRC -9997
+#define HAL_TEMP_ERR_FORMAT -9996
+
+/* Size of a probe id, e.g. "28-0416925607ff". */
+#define HAL_PROBE_ID_SIZE 32
+
+/** Backend of LED output and temperature input. */
+typedef struct {
+    const char* name;
+    /* Returns 0 if succeeded, otherwise -1. */
+    int (*init)(void);
+    /* red/green/blue should be in range 0~255. All 0 turns off the LED. */
+    void (*set_led)(int red, int green, int blue);
+    /* Temperature * 1000, or HAL_TEMP_ERR_*. */
+    int (*read_temperature)(void);
+    /* Copy ids of connected temperature probes, HAL_PROBE_ID_SIZE bytes
+     * each. Returns the number of probes. */
+    int (*list_probes)(char* ids, int max);
+    /* Temperature * 1000 of a probe, or HAL_TEMP_ERR_*. */
+    int (*read_probe_temperature)(const char* probe_id);
+} hal_backend_t;
+
+typedef struct {
+    /* Temperature curve: "{sec}:{celsius},..." repeated over time,
+     * interpolated linearly between points. e.g. "0:20,60:30,120:20" */
+    const char* temperature_curve;
+    /* Time a read takes. DS18B20 takes about 750ms. */
+    unsigned int latency_ms;
+    /* Probabilities in 0.0~1.0. */
+    double crc_fault_rate;
+    double missing_fault_rate;
+    unsigned int seed;
+    /* Number of probes to simulate. 0 for 1. The curve of each probe is
+     * shifted in time so that they differ. */
+    unsigned int probe_num;
+} hal_sim_config_t;
+
+extern const hal_backend_t hal_pi_backend;
+extern const hal_backend_t hal_sim_backend;
+
+/** Set up simulation backend. Call before hal_init() with "sim". */
+int hal_sim_configure(const hal_sim_config_t* config);
+
+/** Select and initialize backend.
+ *
+ * @param [in] name "pi" or "sim".
+ * @param [in] actuator_log file to log LED changes to. NULL not to log.
+ *
+ * @return 0 if succeeded, otherwise -1.
+ */
+int hal_init(const char* name, FILE* actuator_log);
+
+const char* hal_backend_name();
+
+void hal_turn_on_led(int red, int green, int blue);
+
+void hal_turn_off_led();
+
+int hal_read_temperature();
+
+/** Find temperature probes.
+ *
+ * @param [out] ids ids of probes, HAL_PROBE_ID_SIZE bytes each.
+ * @param [in] max max number of ids.
+ *
+ * @return number of probes found.
+ */
+int hal_list_probes(char ids[][HAL_PROBE_ID_SIZE], int max);
+
+int hal_read_probe_temperature(const char* probe_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HAL */
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,225 @@
+#include "hal.h"
+#include "pi_control.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HAL_SIM_MAX_POINTS 32
+#define HAL_SIM_DEFAULT_CURVE "0:25"
+#define HAL_SIM_PROBE_PREFIX "sim-"
+
+typedef struct {
+    double sec;
+    double celsius;
+} prv_point_t;
+
+static prv_point_t m_points[HAL_SIM_MAX_POINTS];
+static int m_point_num = 0;
+static hal_sim_config_t m_config;
+static unsigned int m_seed;
+static struct timespec m_start;
+static pthread_mutex_t m_sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int prv_parse_curve(const char* curve)
+{
+    const char* p = curve;
+    m_point_num = 0;
+    while (*p != '\0') {
+        char* end;
+        if (m_point_num == HAL_SIM_MAX_POINTS) {
+            return -1;
+        }
+        double sec = strtod(p, &end);
+        if (end == p || *end != ':') {
+            return -1;
+        }
+        p = end + 1;
+        double celsius = strtod(p, &end);
+        if (end == p) {
+            return -1;
+        }
+        if (m_point_num > 0 && sec <= m_points[m_point_num - 1].sec) {
+            return -1;
+        }
+        m_points[m_point_num].sec = sec;
+        m_points[m_point_num].celsius = celsius;
+        m_point_num++;
+        p = end;
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return -1;
+        }
+    }
+    return m_point_num > 0 ? 0 : -1;
+}
+
+int hal_sim_configure(const hal_sim_config_t* config)
+{
+    m_config = *config;
+    if (m_config.temperature_curve == NULL) {
+        m_config.temperature_curve = HAL_SIM_DEFAULT_CURVE;
+    }
+    if (prv_parse_curve(m_config.temperature_curve) != 0) {
+        printf("invalid temperature curve: %s\n", m_config.temperature_curve);
+        return -1;
+    }
+    return 0;
+}
+
+static int prv_sim_init(void)
+{
+    if (m_point_num == 0) {
+        hal_sim_config_t config;
+        memset(&config, 0, sizeof(config));
+        if (hal_sim_configure(&config) != 0) {
+            return -1;
+        }
+    }
+    m_seed = m_config.seed;
+    clock_gettime(CLOCK_MONOTONIC, &m_start);
+    return 0;
+}
+
+static void prv_sim_set_led(int red, int green, int blue)
+{
+    /* Actuator changes are logged by hal.c */
+}
+
+/* Temperature of the curve at sec, which repeats after the last point. */
+static double prv_curve_at(double sec)
+{
+    double period = m_points[m_point_num - 1].sec;
+    if (m_point_num == 1 || period <= 0) {
+        return m_points[0].celsius;
+    }
+    while (sec >= period) {
+        sec -= period;
+    }
+    for (int i = 1; i < m_point_num; ++i) {
+        if (sec < m_points[i].sec) {
+            const prv_point_t* a = &m_points[i - 1];
+            const prv_point_t* b = &m_points[i];
+            return a->celsius + (b->celsius - a->celsius)
+                * (sec - a->sec) / (b->sec - a->sec);
+        }
+    }
+    return m_points[m_point_num - 1].celsius;
+}
+
+/* CRC of the DS18B20 scratchpad (Dallas/Maxim, x^8 + x^5 + x^4 + 1). */
+static unsigned char prv_crc8(const unsigned char* data, size_t len)
+{
+    unsigned char crc = 0;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char byte = data[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            unsigned char mix = (crc ^ byte) & 0x01;
+            crc >>= 1;
+            if (mix) {
+                crc ^= 0x8c;
+            }
+            byte >>= 1;
+        }
+    }
+    return crc;
+}
+
+/* Text of w1_slave as the kernel writes it: the scratchpad with its CRC
+ * check, then the same bytes and the temperature in 1/16 degree steps. */
+static void prv_w1_slave(char* buffer, size_t size, double celsius, int crc_ok)
+{
+    int raw = (int)(celsius * 16 + (celsius >= 0 ? 0.5 : -0.5));
+    unsigned char pad[9] = {
+        raw & 0xff, (raw >> 8) & 0xff, 0x4b, 0x46, 0x7f, 0xff, 0x0c, 0x10, 0
+    };
+    pad[8] = prv_crc8(pad, 8);
+    if (!crc_ok) {
+        // Bit error on the bus.
+        pad[3] ^= 0x01;
+    }
+    char hex[3 * 9 + 1];
+    for (int i = 0; i < 9; ++i) {
+        snprintf(&hex[3 * i], 4, "%02x ", pad[i]);
+    }
+    snprintf(buffer, size, "%s: crc=%02x %s\n%st=%d\n",
+            hex, pad[8], prv_crc8(pad, 9) == 0 ? "YES" : "NO",
+            hex, raw * 1000 / 16);
+}
+
+/* Temperature at sec after start, or a simulated fault, parsed from
+ * w1_slave text as the pi backend does. */
+static int prv_sim_read(double offset_sec)
+{
+    struct timespec now;
+    double roll;
+    char w1_slave[128];
+
+    if (m_config.latency_ms > 0) {
+        usleep(m_config.latency_ms * 1000);
+    }
+    pthread_mutex_lock(&m_sim_mutex);
+    roll = (double)rand_r(&m_seed) / RAND_MAX;
+    pthread_mutex_unlock(&m_sim_mutex);
+    if (roll < m_config.missing_fault_rate) {
+        /* w1_slave is gone with the sensor. */
+        return HAL_TEMP_ERR_NO_DEVICE;
+    }
+    int crc_ok = roll >= m_config.missing_fault_rate + m_config.crc_fault_rate;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double sec = (now.tv_sec - m_start.tv_sec)
+        + (now.tv_nsec - m_start.tv_nsec) / 1e9;
+    prv_w1_slave(w1_slave, sizeof(w1_slave), prv_curve_at(sec + offset_sec),
+            crc_ok);
+    return parseDS18B20(w1_slave);
+}
+
+static int prv_sim_read_temperature(void)
+{
+    return prv_sim_read(0);
+}
+
+static int prv_probe_num()
+{
+    return m_config.probe_num > 0 ? (int)m_config.probe_num : 1;
+}
+
+static int prv_sim_list_probes(char* ids, int max)
+{
+    int num = 0;
+    while (num < max && num < prv_probe_num()) {
+        snprintf(&ids[num * HAL_PROBE_ID_SIZE], HAL_PROBE_ID_SIZE, "%s%d",
+                HAL_SIM_PROBE_PREFIX, num);
+        num++;
+    }
+    return num;
+}
+
+static int prv_sim_read_probe_temperature(const char* probe_id)
+{
+    size_t prefix_len = strlen(HAL_SIM_PROBE_PREFIX);
+    if (strncmp(probe_id, HAL_SIM_PROBE_PREFIX, prefix_len) != 0) {
+        return HAL_TEMP_ERR_NO_DEVICE;
+    }
+    int index = atoi(&probe_id[prefix_len]);
+    if (index < 0 || index >= prv_probe_num()) {
+        return HAL_TEMP_ERR_NO_DEVICE;
+    }
+    double period = m_points[m_point_num - 1].sec;
+    return prv_sim_read(period * index / prv_probe_num());
+}
+
+const hal_backend_t hal_sim_backend = {
+    "sim",
+    prv_sim_init,
+    prv_sim_set_led,
+    prv_sim_read_temperature,
+    prv_sim_list_probes,
+    prv_sim_read_probe_temperature
+};
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
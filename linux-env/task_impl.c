@@ -1,7 +1,58 @@
 #include "task_impl.h"
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 
+/* A stack slot is taken by a task until its thread has exited. Tasks are
+ * stopped and created again when a thing is onboarded again, so the slot
+ * of an exited task is reused. The thread is joined first, as it still
+ * runs on the stack after the task entry returns. */
+typedef enum {
+    PRV_SLOT_FREE,
+    PRV_SLOT_RUNNING,
+    PRV_SLOT_EXITED
+} prv_slot_state_t;
+
+typedef struct {
+    prv_slot_state_t state;
+    pthread_t thread;
+    KII_TASK_ENTRY entry;
+    void* param;
+} prv_slot_t;
+
+static unsigned char m_task_stacks[TASK_STACK_NUM][TASK_STACK_SIZE]
+    __attribute__((aligned(16)));
+static prv_slot_t m_task_slots[TASK_STACK_NUM];
+static pthread_mutex_t m_task_stack_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void* prv_task_main(void* arg)
+{
+    prv_slot_t* slot = (prv_slot_t*)arg;
+    void* ret = slot->entry(slot->param);
+    pthread_mutex_lock(&m_task_stack_mutex);
+    slot->state = PRV_SLOT_EXITED;
+    pthread_mutex_unlock(&m_task_stack_mutex);
+    return ret;
+}
+
+/* Called with m_task_stack_mutex. Returns -1 if all slots are running. */
+static int prv_take_slot()
+{
+    for (int i = 0; i < TASK_STACK_NUM; ++i) {
+        if (m_task_slots[i].state == PRV_SLOT_FREE) {
+            return i;
+        }
+    }
+    for (int i = 0; i < TASK_STACK_NUM; ++i) {
+        if (m_task_slots[i].state == PRV_SLOT_EXITED) {
+            pthread_join(m_task_slots[i].thread, NULL);
+            m_task_slots[i].state = PRV_SLOT_FREE;
+            return i;
+        }
+    }
+    return -1;
+}
+
 kii_task_code_t task_create_cb(
         const char* name,
         KII_TASK_ENTRY entry,
@@ -10,8 +61,29 @@ kii_task_code_t task_create_cb(
 {
     int ret;
     pthread_t pthid;
+    pthread_attr_t attr;
 
-    ret = pthread_create(&pthid, NULL, entry, param);
+    pthread_attr_init(&attr);
+    pthread_mutex_lock(&m_task_stack_mutex);
+    int index = prv_take_slot();
+    if (index >= 0) {
+        prv_slot_t* slot = &m_task_slots[index];
+        slot->state = PRV_SLOT_RUNNING;
+        slot->entry = entry;
+        slot->param = param;
+        // Joinable, so that the slot is reused after the thread exits.
+        pthread_attr_setstack(&attr, m_task_stacks[index], TASK_STACK_SIZE);
+        ret = pthread_create(&slot->thread, &attr, prv_task_main, slot);
+        if (ret != 0) {
+            slot->state = PRV_SLOT_FREE;
+        }
+    } else {
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        pthread_attr_setstacksize(&attr, TASK_STACK_SIZE);
+        ret = pthread_create(&pthid, &attr, entry, param);
+    }
+    pthread_mutex_unlock(&m_task_stack_mutex);
+    pthread_attr_destroy(&attr);
 
     if(ret == 0)
     {
@@ -27,4 +99,67 @@ void delay_ms_cb(unsigned int msec, void* userdata)
 {
     usleep(msec * 1000);
 }
+
+static void add_ms(struct timespec* ts, unsigned int msec)
+{
+    ts->tv_sec += msec / 1000;
+    ts->tv_nsec += (long)(msec % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+void wakeable_delay_init(wakeable_delay_t* delay, unsigned int debounce_ms)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&delay->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&delay->mutex, NULL);
+    delay->woken = 0;
+    delay->debounce_ms = debounce_ms;
+}
+
+void wakeable_delay_ms_cb(unsigned int msec, void* userdata)
+{
+    wakeable_delay_t* delay = (wakeable_delay_t*)userdata;
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    add_ms(&deadline, msec);
+
+    pthread_mutex_lock(&delay->mutex);
+    while (!delay->woken) {
+        if (pthread_cond_timedwait(&delay->cond, &delay->mutex, &deadline) != 0) {
+            break;
+        }
+    }
+    /* Let a burst of wakes settle, but not forever. */
+    int rounds = 0;
+    while (delay->woken && rounds++ < 10) {
+        struct timespec quiet;
+        delay->woken = 0;
+        clock_gettime(CLOCK_MONOTONIC, &quiet);
+        add_ms(&quiet, delay->debounce_ms);
+        while (!delay->woken) {
+            if (pthread_cond_timedwait(&delay->cond, &delay->mutex, &quiet) != 0) {
+                break;
+            }
+        }
+    }
+    /* Wakes of the last round are covered by the caller's work which
+     * follows, and must not end the next delay at once. */
+    delay->woken = 0;
+    pthread_mutex_unlock(&delay->mutex);
+}
+
+void delay_wake(wakeable_delay_t* delay)
+{
+    pthread_mutex_lock(&delay->mutex);
+    delay->woken = 1;
+    pthread_cond_signal(&delay->cond);
+    pthread_mutex_unlock(&delay->mutex);
+}
 /* vim:set ts=4 sts=4 sw=4 et fenc=UTF-8 ff=unix: */
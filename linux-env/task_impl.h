@@ -2,11 +2,22 @@
 #define _KII_TASK_IMPL
 
 #include <kii_task_callback.h>
+#include <pthread.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Stacks for tasks are preallocated, and the stack of a task is reused
+ * after the task exits. Tasks created while all of them are taken by
+ * running tasks get a stack of TASK_STACK_SIZE from the system. */
+#ifndef TASK_STACK_NUM
+#define TASK_STACK_NUM 4
+#endif
+#ifndef TASK_STACK_SIZE
+#define TASK_STACK_SIZE (128 * 1024)
+#endif
+
 kii_task_code_t task_create_cb
     (const char* name,
      KII_TASK_ENTRY entry,
@@ -17,6 +28,33 @@ void delay_ms_cb
     (unsigned int msec,
      void* userdata);
 
+/* Delay which can be ended early by delay_wake(). */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int woken;
+    /* Quiet period after a wake before the delay ends. */
+    unsigned int debounce_ms;
+} wakeable_delay_t;
+
+void wakeable_delay_init
+    (wakeable_delay_t* delay,
+     unsigned int debounce_ms);
+
+/** Delay for msec, or until debounce_ms passes without wake after a wake.
+ * Usable as delay callback with wakeable_delay_t as userdata.
+ *
+ * A burst of wakes ends the delay once, after at most 10 quiet periods.
+ * A wake while no delay is running, e.g. during an upload, is kept and
+ * ends the next delay after one quiet period, so all wakes during the
+ * upload are coalesced into one more upload. */
+void wakeable_delay_ms_cb
+    (unsigned int msec,
+     void* userdata);
+
+void delay_wake
+    (wakeable_delay_t* delay);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,314 @@
+#include "local_api.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define LOCAL_API_POLL_MS 200
+
+static int prv_set_nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int prv_listen_unix(const char* path)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    /* Remove socket left by the last run. */
+    unlink(path);
+    /* Created as 0660, so that others can not connect before a chmod().
+     * Called at startup, before other threads create files. */
+    mode_t mask = umask(0117);
+    int ret = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(mask);
+    if (ret != 0
+            || listen(fd, 16) != 0
+            || prv_set_nonblock(fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int prv_listen_tcp(unsigned short port)
+{
+    struct sockaddr_in addr;
+    int on = 1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+            || listen(fd, 16) != 0
+            || prv_set_nonblock(fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void prv_accept(local_api_t* api, int listen_fd, int is_tcp)
+{
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        local_api_client_t* client = NULL;
+        for (int i = 0; i < LOCAL_API_MAX_CLIENTS; ++i) {
+            if (api->clients[i].fd < 0) {
+                client = &api->clients[i];
+                break;
+            }
+        }
+        if (client == NULL || prv_set_nonblock(fd) != 0) {
+            close(fd);
+            continue;
+        }
+        if (is_tcp) {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+        client->fd = fd;
+        client->in_len = 0;
+        client->discarding = 0;
+        client->out_len = 0;
+        client->out_sent = 0;
+    }
+}
+
+static void prv_close_client(local_api_client_t* client)
+{
+    close(client->fd);
+    client->fd = -1;
+}
+
+/* Returns -1 if the client is closed. */
+static int prv_flush(local_api_client_t* client)
+{
+    while (client->out_sent < client->out_len) {
+        ssize_t ret = send(client->fd, &client->out[client->out_sent],
+                client->out_len - client->out_sent, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            prv_close_client(client);
+            return -1;
+        }
+        client->out_sent += ret;
+    }
+    client->out_len = 0;
+    client->out_sent = 0;
+    return 0;
+}
+
+/* Handle buffered lines while the response buffer is free. */
+static int prv_process(local_api_t* api, local_api_client_t* client)
+{
+    while (client->out_len == 0) {
+        char* nl = memchr(client->in, '\n', client->in_len);
+        if (client->discarding) {
+            if (nl == NULL) {
+                client->in_len = 0;
+                return 0;
+            }
+            size_t consumed = nl - client->in + 1;
+            memmove(client->in, nl + 1, client->in_len - consumed);
+            client->in_len -= consumed;
+            client->discarding = 0;
+            continue;
+        }
+        if (nl == NULL) {
+            if (client->in_len == sizeof(client->in)) {
+                client->in_len = 0;
+                client->discarding = 1;
+                client->out_len = snprintf(client->out, sizeof(client->out),
+                        "{\"error\":\"request too long\"}\n");
+                return prv_flush(client);
+            }
+            return 0;
+        }
+        *nl = '\0';
+        if (nl > client->in && nl[-1] == '\r') {
+            nl[-1] = '\0';
+        }
+        size_t len = api->request_cb(client->in, client->out,
+                sizeof(client->out) - 1, api->request_userdata);
+        if (len > sizeof(client->out) - 1) {
+            len = sizeof(client->out) - 1;
+        }
+        client->out[len] = '\n';
+        client->out_len = len + 1;
+        client->out_sent = 0;
+
+        size_t consumed = nl - client->in + 1;
+        memmove(client->in, nl + 1, client->in_len - consumed);
+        client->in_len -= consumed;
+
+        if (prv_flush(client) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void prv_read(local_api_t* api, local_api_client_t* client)
+{
+    ssize_t ret = recv(client->fd, &client->in[client->in_len],
+            sizeof(client->in) - client->in_len, 0);
+    if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        prv_close_client(client);
+        return;
+    }
+    if (ret > 0) {
+        client->in_len += ret;
+        prv_process(api, client);
+    }
+}
+
+static void* prv_loop(void* param)
+{
+    local_api_t* api = (local_api_t*)param;
+    struct pollfd fds[LOCAL_API_MAX_CLIENTS + 2];
+    local_api_client_t* owners[LOCAL_API_MAX_CLIENTS + 2];
+
+    while (!api->stopped) {
+        int num = 0;
+        if (api->unix_fd >= 0) {
+            fds[num].fd = api->unix_fd;
+            fds[num].events = POLLIN;
+            owners[num++] = NULL;
+        }
+        if (api->tcp_fd >= 0) {
+            fds[num].fd = api->tcp_fd;
+            fds[num].events = POLLIN;
+            owners[num++] = NULL;
+        }
+        for (int i = 0; i < LOCAL_API_MAX_CLIENTS; ++i) {
+            local_api_client_t* client = &api->clients[i];
+            if (client->fd < 0) {
+                continue;
+            }
+            fds[num].fd = client->fd;
+            /* Stop reading while a response is pending. */
+            fds[num].events = client->out_len > 0 ? POLLOUT : POLLIN;
+            owners[num++] = client;
+        }
+
+        int ret = poll(fds, num, LOCAL_API_POLL_MS);
+        if (ret <= 0) {
+            continue;
+        }
+        for (int i = 0; i < num; ++i) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            local_api_client_t* client = owners[i];
+            if (client == NULL) {
+                prv_accept(api, fds[i].fd, fds[i].fd == api->tcp_fd);
+            } else if (fds[i].revents & POLLOUT) {
+                if (prv_flush(client) == 0) {
+                    prv_process(api, client);
+                }
+            } else if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                prv_read(api, client);
+            }
+        }
+    }
+    return NULL;
+}
+
+int local_api_start(
+        local_api_t* api,
+        const char* socket_path,
+        unsigned short tcp_port,
+        LOCAL_API_REQUEST_CB request_cb,
+        void* userdata)
+{
+    memset(api, 0, sizeof(*api));
+    api->unix_fd = -1;
+    api->tcp_fd = -1;
+    api->request_cb = request_cb;
+    api->request_userdata = userdata;
+    for (int i = 0; i < LOCAL_API_MAX_CLIENTS; ++i) {
+        api->clients[i].fd = -1;
+    }
+
+    if (socket_path != NULL) {
+        api->unix_fd = prv_listen_unix(socket_path);
+        if (api->unix_fd < 0) {
+            printf("failed to listen on %s.\n", socket_path);
+            return -1;
+        }
+    }
+    if (tcp_port != 0) {
+        api->tcp_fd = prv_listen_tcp(tcp_port);
+        if (api->tcp_fd < 0) {
+            printf("failed to listen on 127.0.0.1:%u.\n", tcp_port);
+            if (api->unix_fd >= 0) {
+                close(api->unix_fd);
+            }
+            return -1;
+        }
+    }
+    if (pthread_create(&api->thread, NULL, prv_loop, api) != 0) {
+        if (api->unix_fd >= 0) {
+            close(api->unix_fd);
+        }
+        if (api->tcp_fd >= 0) {
+            close(api->tcp_fd);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+void local_api_stop(local_api_t* api)
+{
+    api->stopped = 1;
+    pthread_join(api->thread, NULL);
+    for (int i = 0; i < LOCAL_API_MAX_CLIENTS; ++i) {
+        if (api->clients[i].fd >= 0) {
+            prv_close_client(&api->clients[i]);
+        }
+    }
+    if (api->unix_fd >= 0) {
+        close(api->unix_fd);
+    }
+    if (api->tcp_fd >= 0) {
+        close(api->tcp_fd);
+    }
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,78 @@
+#ifndef __LOCAL_API
+#define __LOCAL_API
+
+#include <pthread.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOCAL_API_MAX_CLIENTS 32
+#define LOCAL_API_LINE_SIZE 256
+#define LOCAL_API_RESPONSE_SIZE 1024
+
+/** Handle one request line.
+ *
+ * Called on the event loop thread, so it must not block.
+ *
+ * @param [in] request request line without line terminator.
+ * @param [out] response buffer to write the response to.
+ * @param [in] response_size size of response buffer.
+ * @param [in] userdata userdata given to local_api_start().
+ *
+ * @return length of the response. A newline is appended by the server.
+ */
+typedef size_t (*LOCAL_API_REQUEST_CB)(
+        const char* request,
+        char* response,
+        size_t response_size,
+        void* userdata);
+
+typedef struct {
+    int fd;
+    size_t in_len;
+    char in[LOCAL_API_LINE_SIZE];
+    /* Rest of a too long line is dropped up to its newline. */
+    int discarding;
+    size_t out_len;
+    size_t out_sent;
+    char out[LOCAL_API_RESPONSE_SIZE];
+} local_api_client_t;
+
+typedef struct {
+    int unix_fd;
+    int tcp_fd;
+    volatile int stopped;
+    pthread_t thread;
+    LOCAL_API_REQUEST_CB request_cb;
+    void* request_userdata;
+    local_api_client_t clients[LOCAL_API_MAX_CLIENTS];
+} local_api_t;
+
+/** Start serving requests.
+ *
+ * @param [out] api server to start.
+ * @param [in] socket_path path of UNIX domain socket. NULL not to listen.
+ * @param [in] tcp_port port to listen on 127.0.0.1. 0 not to listen.
+ * @param [in] request_cb callback to handle requests.
+ * @param [in] userdata passed to request_cb.
+ *
+ * @return 0 if succeeded, otherwise -1.
+ */
+int local_api_start(
+        local_api_t* api,
+        const char* socket_path,
+        unsigned short tcp_port,
+        LOCAL_API_REQUEST_CB request_cb,
+        void* userdata);
+
+/** Stop serving and close all connections. */
+void local_api_stop(local_api_t* api);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LOCAL_API */
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,295 @@
+#include "mem_pool.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/crypto.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+typedef struct prv_block_t {
+    struct prv_block_t* next;
+} prv_block_t;
+
+typedef struct {
+    size_t block_size;
+    size_t block_count;
+    unsigned char* start;
+    unsigned char* end;
+    prv_block_t* free_list;
+    size_t in_use;
+    size_t peak;
+} prv_class_t;
+
+typedef struct {
+    const char* name;
+    size_t size;
+} prv_reservation_t;
+
+#define X(size, count) { size, count, NULL, NULL, NULL, 0, 0 },
+static prv_class_t m_classes[] = { MEM_POOL_CLASSES };
+#undef X
+#define CLASS_NUM (sizeof(m_classes) / sizeof(m_classes[0]))
+
+#define X(size, count) + (size) * (count)
+#define ARENA_SIZE_PER_CONNECTION (0 MEM_POOL_CLASSES)
+static unsigned char* m_arena;
+static size_t m_arena_size;
+static pthread_mutex_t m_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static mem_pool_stats_t m_stats;
+
+static size_t m_budget;
+static size_t m_reserved;
+static prv_reservation_t m_reservations[MEM_POOL_MAX_RESERVATIONS];
+static size_t m_reservation_num;
+
+static prv_class_t* prv_class_of(void* ptr)
+{
+    unsigned char* p = (unsigned char*)ptr;
+    if (m_arena == NULL || p < m_arena || p >= m_arena + m_arena_size) {
+        return NULL;
+    }
+    for (size_t i = 0; i < CLASS_NUM; ++i) {
+        if (p >= m_classes[i].start && p < m_classes[i].end) {
+            return &m_classes[i];
+        }
+    }
+    return NULL;
+}
+
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
+static void* prv_crypto_malloc(size_t num)
+{
+    return mem_pool_alloc(num);
+}
+
+static void* prv_crypto_realloc(void* addr, size_t num)
+{
+    return mem_pool_realloc(addr, num);
+}
+
+static void prv_crypto_free(void* addr)
+{
+    mem_pool_free(addr);
+}
+#else
+static void* prv_crypto_malloc(size_t num, const char* file, int line)
+{
+    return mem_pool_alloc(num);
+}
+
+static void* prv_crypto_realloc(void* addr, size_t num, const char* file,
+        int line)
+{
+    return mem_pool_realloc(addr, num);
+}
+
+static void prv_crypto_free(void* addr, const char* file, int line)
+{
+    mem_pool_free(addr);
+}
+#endif
+
+static size_t prv_process_heap()
+{
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#elif defined(__GLIBC__)
+    struct mallinfo info = mallinfo();
+    return (size_t)(unsigned int)info.uordblks
+        + (size_t)(unsigned int)info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+int mem_pool_init(size_t budget, size_t connections)
+{
+    m_budget = budget;
+    m_reserved = 0;
+    m_reservation_num = 0;
+    m_arena_size = ARENA_SIZE_PER_CONNECTION * connections;
+    if (mem_pool_reserve("openssl arena", m_arena_size) != 0) {
+        return -1;
+    }
+    m_arena = aligned_alloc(16, m_arena_size);
+    if (m_arena == NULL) {
+        printf("failed to allocate OpenSSL arena.\n");
+        return -1;
+    }
+
+    unsigned char* p = m_arena;
+    for (size_t i = 0; i < CLASS_NUM; ++i) {
+        prv_class_t* cls = &m_classes[i];
+        cls->block_count *= connections;
+        cls->start = p;
+        cls->free_list = NULL;
+        cls->in_use = 0;
+        cls->peak = 0;
+        for (size_t j = 0; j < cls->block_count; ++j) {
+            prv_block_t* block = (prv_block_t*)p;
+            block->next = cls->free_list;
+            cls->free_list = block;
+            p += cls->block_size;
+        }
+        cls->end = p;
+    }
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_stats.arena_size = m_arena_size;
+
+    if (CRYPTO_set_mem_functions(
+                prv_crypto_malloc,
+                prv_crypto_realloc,
+                prv_crypto_free) != 1) {
+        printf("failed to set OpenSSL memory functions.\n");
+        return -1;
+    }
+    return 0;
+}
+
+int mem_pool_reserve(const char* name, size_t size)
+{
+    if (m_reservation_num < MEM_POOL_MAX_RESERVATIONS) {
+        m_reservations[m_reservation_num].name = name;
+        m_reservations[m_reservation_num].size = size;
+        m_reservation_num++;
+    }
+    m_reserved += size;
+    if (m_reserved > m_budget) {
+        printf("memory budget exceeded by %s: %zu > %zu bytes\n",
+                name, m_reserved, m_budget);
+        return -1;
+    }
+    return 0;
+}
+
+void mem_pool_print_budget()
+{
+    for (size_t i = 0; i < m_reservation_num; ++i) {
+        printf("  %-16s %8zu bytes\n",
+                m_reservations[i].name, m_reservations[i].size);
+    }
+    printf("  %-16s %8zu / %zu bytes\n", "total", m_reserved, m_budget);
+}
+
+void mem_pool_print_classes()
+{
+    pthread_mutex_lock(&m_pool_mutex);
+    for (size_t i = 0; i < CLASS_NUM; ++i) {
+        printf("  %6zu bytes: in_use=%zu peak=%zu count=%zu\n",
+                m_classes[i].block_size, m_classes[i].in_use,
+                m_classes[i].peak, m_classes[i].block_count);
+    }
+    pthread_mutex_unlock(&m_pool_mutex);
+}
+
+void* mem_pool_alloc(size_t size)
+{
+    void* ptr = NULL;
+
+    pthread_mutex_lock(&m_pool_mutex);
+    for (size_t i = 0; i < CLASS_NUM; ++i) {
+        prv_class_t* cls = &m_classes[i];
+        if (size <= cls->block_size && cls->free_list != NULL) {
+            ptr = cls->free_list;
+            cls->free_list = cls->free_list->next;
+            if (++cls->in_use > cls->peak) {
+                cls->peak = cls->in_use;
+            }
+            m_stats.arena_in_use += cls->block_size;
+            if (m_stats.arena_in_use > m_stats.arena_peak) {
+                m_stats.arena_peak = m_stats.arena_in_use;
+            }
+            m_stats.openssl_pool_allocs++;
+            break;
+        }
+    }
+    if (ptr == NULL) {
+        m_stats.openssl_heap_allocs++;
+        if (m_stats.warm) {
+            m_stats.openssl_heap_allocs_after_warm++;
+        }
+    }
+    if (m_stats.warm) {
+        m_stats.openssl_allocs_after_warm++;
+    }
+    pthread_mutex_unlock(&m_pool_mutex);
+
+    if (ptr == NULL) {
+        ptr = malloc(size);
+    }
+    return ptr;
+}
+
+void* mem_pool_realloc(void* ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return mem_pool_alloc(size);
+    }
+    prv_class_t* cls = prv_class_of(ptr);
+    if (cls == NULL) {
+        pthread_mutex_lock(&m_pool_mutex);
+        m_stats.openssl_heap_allocs++;
+        if (m_stats.warm) {
+            m_stats.openssl_allocs_after_warm++;
+            m_stats.openssl_heap_allocs_after_warm++;
+        }
+        pthread_mutex_unlock(&m_pool_mutex);
+        return realloc(ptr, size);
+    }
+    if (size <= cls->block_size) {
+        return ptr;
+    }
+    void* new_ptr = mem_pool_alloc(size);
+    if (new_ptr != NULL) {
+        memcpy(new_ptr, ptr, cls->block_size);
+        mem_pool_free(ptr);
+    }
+    return new_ptr;
+}
+
+void mem_pool_free(void* ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    prv_class_t* cls = prv_class_of(ptr);
+    if (cls == NULL) {
+        free(ptr);
+        return;
+    }
+    pthread_mutex_lock(&m_pool_mutex);
+    prv_block_t* block = (prv_block_t*)ptr;
+    block->next = cls->free_list;
+    cls->free_list = block;
+    cls->in_use--;
+    m_stats.arena_in_use -= cls->block_size;
+    pthread_mutex_unlock(&m_pool_mutex);
+}
+
+void mem_pool_mark_warm()
+{
+    size_t heap = prv_process_heap();
+    pthread_mutex_lock(&m_pool_mutex);
+    m_stats.warm = 1;
+    m_stats.process_heap_at_warm = heap;
+    pthread_mutex_unlock(&m_pool_mutex);
+}
+
+void mem_pool_get_stats(mem_pool_stats_t* out_stats)
+{
+    size_t heap = prv_process_heap();
+    pthread_mutex_lock(&m_pool_mutex);
+    *out_stats = m_stats;
+    pthread_mutex_unlock(&m_pool_mutex);
+    out_stats->process_heap_in_use = heap;
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,102 @@
+#ifndef __MEM_POOL
+#define __MEM_POOL
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of blocks for each size class of the arena, per TLS connection.
+ * The arena has this many blocks times the connections given to
+ * mem_pool_init(). */
+#ifndef MEM_POOL_CLASSES
+#define MEM_POOL_CLASSES \
+    X(32, 2048) \
+    X(64, 344) \
+    X(128, 512) \
+    X(256, 176) \
+    X(512, 24) \
+    X(1024, 12) \
+    X(2048, 6) \
+    X(4096, 6) \
+    X(8192, 3) \
+    X(16384, 2) \
+    X(32768, 4)
+#endif
+
+#define MEM_POOL_MAX_RESERVATIONS 16
+
+typedef struct {
+    size_t arena_size;
+    size_t arena_in_use;
+    size_t arena_peak;
+    /* Counters below see OpenSSL allocations only, as the arena is
+     * installed as OpenSSL allocator. See process_heap_* for the rest. */
+    /* OpenSSL allocations served from the arena. */
+    unsigned long openssl_pool_allocs;
+    /* OpenSSL allocations the arena could not serve and passed to malloc. */
+    unsigned long openssl_heap_allocs;
+    /* OpenSSL allocations of any kind made after mem_pool_mark_warm(). */
+    unsigned long openssl_allocs_after_warm;
+    unsigned long openssl_heap_allocs_after_warm;
+    /* Bytes in use in the malloc heap of the whole process (libc, SDK,
+     * stdio, resolver, OpenSSL fallback), now and at
+     * mem_pool_mark_warm(). This is a net amount: memory allocated and
+     * freed between two reads is not seen. 0 if not available. */
+    size_t process_heap_in_use;
+    size_t process_heap_at_warm;
+    int warm;
+} mem_pool_stats_t;
+
+/** Allocate the arena and install it as OpenSSL allocator.
+ *
+ * Must be called once, before any other OpenSSL function.
+ *
+ * @param [in] budget total bytes of memory the application may reserve,
+ * including the arena itself.
+ * @param [in] connections TLS connections open at once. The arena has
+ * MEM_POOL_CLASSES blocks for each.
+ *
+ * @return 0 if succeeded, otherwise -1.
+ */
+int mem_pool_init(size_t budget, size_t connections);
+
+/** Account memory preallocated for the whole life of the process.
+ *
+ * @param [in] name name shown in mem_pool_print_budget().
+ * @param [in] size size of reserved memory.
+ *
+ * @return 0 if the budget has room for it, otherwise -1.
+ */
+int mem_pool_reserve(const char* name, size_t size);
+
+/** Print how the budget is used. */
+void mem_pool_print_budget();
+
+/** Print peak usage of each size class, to tune MEM_POOL_CLASSES. */
+void mem_pool_print_classes();
+
+void* mem_pool_alloc(size_t size);
+
+void* mem_pool_realloc(void* ptr, size_t size);
+
+void mem_pool_free(void* ptr);
+
+/** Mark the end of warm-up.
+ *
+ * OpenSSL allocations after this are counted in
+ * mem_pool_stats_t#openssl_allocs_after_warm and
+ * mem_pool_stats_t#openssl_heap_allocs_after_warm, and the heap in use of
+ * the process is kept in mem_pool_stats_t#process_heap_at_warm.
+ */
+void mem_pool_mark_warm();
+
+void mem_pool_get_stats(mem_pool_stats_t* out_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MEM_POOL */
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
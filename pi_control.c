@@ -1,5 +1,4 @@
 #include "pi_control.h"
-#include <wiringPi.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,6 +7,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <dirent.h>
+
+#ifndef NO_WIRINGPI
+#include <wiringPi.h>
 #include <softPwm.h>
 
 void initLEDPins() {
@@ -27,35 +30,26 @@ void turnOffLED() {
     softPwmWrite (BLUE_LED, 0);
     softPwmWrite (GREEN_LED, 0);
 }
+#endif
 
-int readDS18B20Temparature()
-{
-    int fd;
-    char *fileName;
-
-    // Allocate space for the filename
-    if ((fileName = malloc(strlen(W1_PREFIX) + strlen(W1_POSTFIX) + strlen(W1_FILE_NAME) + 1)) == NULL)
-        return -9999;
+// Path of the sensor is fixed at compile time and its file is kept open
+// between reads, so reading temperature does not allocate.
+static const char m_w1_path[] = W1_PREFIX W1_FILE_NAME W1_POSTFIX;
+static int m_w1_fd = -1;
+static char m_w1_buffer[4096];
 
-    sprintf(fileName, "%s%s%s", W1_PREFIX, W1_FILE_NAME, W1_POSTFIX);
-    fd = open(fileName, O_RDONLY);
-    free(fileName);
-    if (fd < 0)
-        return -9999;
+static int closeDS18B20(int code)
+{
+    close(m_w1_fd);
+    m_w1_fd = -1;
+    return code;
+}
 
-    char buffer[4096];
-    char *p;
+int parseDS18B20(const char* buffer)
+{
+    const char *p;
     int temp, sign;
 
-    // Rewind the file - we're keeping it open to keep things going
-    //	smoothly
-    lseek(fd, 0, SEEK_SET);
-
-    // Read the file - we know it's only a couple of lines, so this ought to be
-    //	more than enough
-    if (read(fd, buffer, 4096) <= 0) // Read nothing, or it failed in some odd way
-        return -9998;
-
     // Look for YES, then t=
     if (strstr(buffer, "YES") == NULL)
         return -9997;
@@ -83,6 +77,68 @@ int readDS18B20Temparature()
         ++p;
     }
 
-    close(fd);
     return temp * sign;
+}
+
+int readDS18B20Temparature()
+{
+    ssize_t len;
+
+    if (m_w1_fd < 0) {
+        m_w1_fd = open(m_w1_path, O_RDONLY);
+        if (m_w1_fd < 0)
+            return -9999;
+    }
+
+    // Rewind the file - we're keeping it open to keep things going
+    //	smoothly
+    lseek(m_w1_fd, 0, SEEK_SET);
+
+    // Read the file - we know it's only a couple of lines, so this ought to be
+    //	more than enough
+    len = read(m_w1_fd, m_w1_buffer, sizeof(m_w1_buffer) - 1);
+    if (len <= 0) // Read nothing, or it failed in some odd way
+        return closeDS18B20(-9998);
+    m_w1_buffer[len] = '\0';
+
+    return parseDS18B20(m_w1_buffer);
+}
+
+int listDS18B20(char* ids, int id_size, int max)
+{
+    DIR* dir;
+    struct dirent* entry;
+    int num = 0;
+
+    dir = opendir(W1_PREFIX);
+    if (dir == NULL)
+        return 0;
+    while (num < max && (entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "28-", 3) != 0
+                || strlen(entry->d_name) >= (size_t)id_size)
+            continue;
+        strcpy(&ids[num * id_size], entry->d_name);
+        num++;
+    }
+    closedir(dir);
+    return num;
+}
+
+int readDS18B20TemparatureOf(const char* id)
+{
+    char path[128];
+    char buffer[256];
+    ssize_t len;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s%s%s", W1_PREFIX, id, W1_POSTFIX);
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -9999;
+    len = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (len <= 0)
+        return -9998;
+    buffer[len] = '\0';
+    return parseDS18B20(buffer);
 }
\ No newline at end of file
@@ -17,4 +17,12 @@ void turnOnLED(int red, int green, int blue);
 void turnOffLED();
 // readDS18B20Temparature return measured temperature * 1000, you should divide it
 // whether by 1000.0 to get float temperature or by 1000 to get integer temperature.
-int readDS18B20Temparature();
\ No newline at end of file
+int readDS18B20Temparature();
+// Ids ("28-...") of all DS18B20 sensors found under W1_PREFIX are copied to
+// ids, id_size bytes each. Returns the number of sensors, at most max.
+int listDS18B20(char* ids, int id_size, int max);
+// Same as readDS18B20Temparature, for the sensor with given id.
+int readDS18B20TemparatureOf(const char* id);
+// Temperature * 1000 in the text of a w1_slave file, or the error codes of
+// readDS18B20Temparature.
+int parseDS18B20(const char* buffer);
\ No newline at end of file
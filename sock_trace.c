@@ -0,0 +1,468 @@
+#include "sock_trace.h"
+#include "sys_cb_impl.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SOCK_TRACE_MAGIC "SKTR"
+
+typedef struct {
+    uint8_t type;
+    uint8_t stream;
+    uint16_t reserved;
+    uint32_t length;
+    uint64_t time_us;
+} prv_record_header_t;
+
+typedef struct {
+    prv_record_header_t header;
+    const char* data;
+} prv_record_t;
+
+typedef struct {
+    size_t cursor;
+    size_t offset;
+    int used;
+    int done;
+} prv_stream_t;
+
+static sock_trace_mode_t m_mode = SOCK_TRACE_OFF;
+static pthread_mutex_t m_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t m_start_us;
+static sock_trace_stats_t m_stats;
+
+/* Recording */
+static FILE* m_record_fp = NULL;
+
+/* Replaying */
+static char* m_trace_data = NULL;
+static prv_record_t* m_records = NULL;
+static size_t m_record_num = 0;
+static prv_stream_t m_streams[SOCK_TRACE_MAX_STREAMS];
+static int m_realtime = 0;
+/* Signaled with m_trace_mutex on each send. */
+static pthread_cond_t m_send_cond;
+static pthread_once_t m_send_cond_once = PTHREAD_ONCE_INIT;
+static unsigned long m_send_seq = 0;
+
+static uint64_t prv_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void prv_send_cond_init()
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m_send_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static int prv_stream_of(void* sock_ctx)
+{
+    int stream = ((socket_context_t*)sock_ctx)->trace_stream;
+    if (stream < 0 || stream >= SOCK_TRACE_MAX_STREAMS) {
+        return 0;
+    }
+    return stream;
+}
+
+int sock_trace_record_open(const char* path)
+{
+    uint32_t version = SOCK_TRACE_VERSION;
+
+    /* The trace has the password and tokens in plain text. An existing
+     * file keeps its mode on open, so it is restricted as well. */
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+            0600);
+    if (fd >= 0 && fchmod(fd, 0600) == 0) {
+        m_record_fp = fdopen(fd, "wb");
+    }
+    if (m_record_fp == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        printf("failed to open trace file %s.\n", path);
+        return -1;
+    }
+    if (fwrite(SOCK_TRACE_MAGIC, 4, 1, m_record_fp) != 1
+            || fwrite(&version, sizeof(version), 1, m_record_fp) != 1) {
+        fclose(m_record_fp);
+        m_record_fp = NULL;
+        return -1;
+    }
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_start_us = prv_now_us();
+    m_mode = SOCK_TRACE_RECORDING;
+    return 0;
+}
+
+void sock_trace_record(
+        int stream,
+        sock_trace_type_t type,
+        const char* data,
+        size_t length)
+{
+    prv_record_header_t header;
+
+    if (m_mode != SOCK_TRACE_RECORDING) {
+        return;
+    }
+    memset(&header, 0, sizeof(header));
+    header.type = type;
+    header.stream = stream;
+    header.length = length;
+
+    pthread_mutex_lock(&m_trace_mutex);
+    header.time_us = prv_now_us() - m_start_us;
+    fwrite(&header, sizeof(header), 1, m_record_fp);
+    if (length > 0) {
+        fwrite(data, length, 1, m_record_fp);
+    }
+    /* Keep the trace usable even if the app is killed. */
+    fflush(m_record_fp);
+    switch (type) {
+        case SOCK_TRACE_CONNECT:
+            m_stats.connects++;
+            break;
+        case SOCK_TRACE_SEND:
+            m_stats.sent_bytes += length;
+            break;
+        case SOCK_TRACE_RECV:
+            m_stats.recv_bytes += length;
+            break;
+        default:
+            break;
+    }
+    pthread_mutex_unlock(&m_trace_mutex);
+}
+
+int sock_trace_replay_open(const char* path, int realtime)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        printf("failed to open trace file %s.\n", path);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size < 8) {
+        fclose(fp);
+        return -1;
+    }
+    m_trace_data = malloc(size);
+    if (m_trace_data == NULL || fread(m_trace_data, size, 1, fp) != 1) {
+        fclose(fp);
+        free(m_trace_data);
+        m_trace_data = NULL;
+        return -1;
+    }
+    fclose(fp);
+    memset(m_streams, 0, sizeof(m_streams));
+    pthread_once(&m_send_cond_once, prv_send_cond_init);
+
+    uint32_t version;
+    memcpy(&version, &m_trace_data[4], sizeof(version));
+    if (memcmp(m_trace_data, SOCK_TRACE_MAGIC, 4) != 0
+            || version != SOCK_TRACE_VERSION) {
+        printf("unsupported trace file %s.\n", path);
+        goto error;
+    }
+
+    /* Count records, then index them. */
+    size_t num = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        long pos = 8;
+        num = 0;
+        while (pos + (long)sizeof(prv_record_header_t) <= size) {
+            prv_record_header_t header;
+            memcpy(&header, &m_trace_data[pos], sizeof(header));
+            pos += sizeof(header);
+            if (pos + (long)header.length > size
+                    || header.stream >= SOCK_TRACE_MAX_STREAMS) {
+                /* Truncated by a crash while recording. */
+                break;
+            }
+            if (pass == 1) {
+                m_records[num].header = header;
+                m_records[num].data = &m_trace_data[pos];
+                m_streams[header.stream].used = 1;
+            }
+            pos += header.length;
+            num++;
+        }
+        if (pass == 0) {
+            m_records = malloc(sizeof(prv_record_t) * (num > 0 ? num : 1));
+            if (m_records == NULL) {
+                goto error;
+            }
+        }
+    }
+    m_record_num = num;
+    m_realtime = realtime;
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_start_us = prv_now_us();
+    m_mode = SOCK_TRACE_REPLAYING;
+    return 0;
+
+error:
+    free(m_trace_data);
+    m_trace_data = NULL;
+    return -1;
+}
+
+void sock_trace_close()
+{
+    pthread_mutex_lock(&m_trace_mutex);
+    if (m_record_fp != NULL) {
+        fclose(m_record_fp);
+        m_record_fp = NULL;
+    }
+    free(m_records);
+    m_records = NULL;
+    m_record_num = 0;
+    free(m_trace_data);
+    m_trace_data = NULL;
+    m_mode = SOCK_TRACE_OFF;
+    pthread_mutex_unlock(&m_trace_mutex);
+}
+
+sock_trace_mode_t sock_trace_mode()
+{
+    return m_mode;
+}
+
+int sock_trace_replay_done()
+{
+    if (m_mode != SOCK_TRACE_REPLAYING) {
+        return 0;
+    }
+    for (int i = 0; i < SOCK_TRACE_MAX_STREAMS; ++i) {
+        if (m_streams[i].used && !m_streams[i].done) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int sock_trace_replay_fast()
+{
+    return m_mode == SOCK_TRACE_REPLAYING && !m_realtime;
+}
+
+void sock_trace_get_stats(sock_trace_stats_t* out_stats)
+{
+    pthread_mutex_lock(&m_trace_mutex);
+    *out_stats = m_stats;
+    pthread_mutex_unlock(&m_trace_mutex);
+}
+
+/* Index of next record of stream at or after from. */
+static size_t prv_next(int stream, size_t from)
+{
+    while (from < m_record_num && m_records[from].header.stream != stream) {
+        from++;
+    }
+    return from;
+}
+
+/* Fast replay of a receive before the recorded request is sent. Usually
+ * the same task sends it after the receive times out, so the wait is
+ * short, but it keeps the receive loop from spinning on the CPU. */
+static void prv_wait_send()
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += SOCK_TRACE_FAST_BLOCK_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&m_trace_mutex);
+    unsigned long seq = m_send_seq;
+    while (seq == m_send_seq) {
+        if (pthread_cond_timedwait(&m_send_cond, &m_trace_mutex, &deadline)
+                != 0) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&m_trace_mutex);
+}
+
+static void prv_wait_until(const prv_record_t* record)
+{
+    if (!m_realtime) {
+        return;
+    }
+    uint64_t target = m_start_us + record->header.time_us;
+    uint64_t now = prv_now_us();
+    if (target > now) {
+        usleep(target - now);
+    }
+}
+
+khc_sock_code_t
+    sock_replay_connect(void* sock_ctx, const char* host,
+            unsigned int port)
+{
+    int stream = prv_stream_of(sock_ctx);
+    prv_stream_t* st = &m_streams[stream];
+    unsigned long missing = 0;
+    size_t idx = prv_next(stream, st->cursor);
+    /* Rest of the previous connection, which the app closed earlier than
+     * recorded. */
+    while (idx < m_record_num
+            && m_records[idx].header.type != SOCK_TRACE_CONNECT) {
+        if (m_records[idx].header.type == SOCK_TRACE_SEND) {
+            missing += m_records[idx].header.length - st->offset;
+        }
+        st->offset = 0;
+        idx = prv_next(stream, idx + 1);
+    }
+    st->cursor = idx;
+    st->offset = 0;
+    khc_sock_code_t ret = KHC_SOCK_FAIL;
+    if (idx == m_record_num) {
+        st->done = 1;
+    } else {
+        prv_wait_until(&m_records[idx]);
+        st->cursor = idx + 1;
+        ret = KHC_SOCK_OK;
+    }
+
+    pthread_mutex_lock(&m_trace_mutex);
+    if (ret == KHC_SOCK_OK) {
+        m_stats.connects++;
+    }
+    m_stats.send_missing += missing;
+    pthread_mutex_unlock(&m_trace_mutex);
+    return ret;
+}
+
+khc_sock_code_t
+    sock_replay_send(void* sock_ctx,
+            const char* buffer,
+            size_t length,
+            size_t* out_sent_length)
+{
+    int stream = prv_stream_of(sock_ctx);
+    prv_stream_t* st = &m_streams[stream];
+    size_t remaining = length;
+    unsigned long mismatches = 0;
+    unsigned long unexpected = 0;
+
+    while (remaining > 0) {
+        size_t idx = prv_next(stream, st->cursor);
+        if (idx == m_record_num
+                || m_records[idx].header.type != SOCK_TRACE_SEND) {
+            unexpected = remaining;
+            break;
+        }
+        const prv_record_t* record = &m_records[idx];
+        size_t n = record->header.length - st->offset;
+        if (n > remaining) {
+            n = remaining;
+        }
+        const char* expected = &record->data[st->offset];
+        for (size_t i = 0; i < n; ++i) {
+            if (expected[i] != buffer[length - remaining + i]) {
+                mismatches++;
+            }
+        }
+        remaining -= n;
+        st->offset += n;
+        st->cursor = idx;
+        if (st->offset == record->header.length) {
+            st->cursor = idx + 1;
+            st->offset = 0;
+        }
+    }
+
+    pthread_mutex_lock(&m_trace_mutex);
+    m_stats.sent_bytes += length;
+    m_stats.send_mismatches += mismatches;
+    m_stats.send_unexpected += unexpected;
+    m_send_seq++;
+    pthread_cond_broadcast(&m_send_cond);
+    pthread_mutex_unlock(&m_trace_mutex);
+
+    *out_sent_length = length;
+    return KHC_SOCK_OK;
+}
+
+khc_sock_code_t
+    sock_replay_recv(void* sock_ctx, char* buffer, size_t length_to_read,
+            size_t* out_actual_length)
+{
+    int stream = prv_stream_of(sock_ctx);
+    prv_stream_t* st = &m_streams[stream];
+    khc_sock_code_t ret = KHC_SOCK_OK;
+    unsigned long blocked = 0;
+    size_t idx = prv_next(stream, st->cursor);
+    const prv_record_t* record = idx < m_record_num ? &m_records[idx] : NULL;
+
+    *out_actual_length = 0;
+    if (record == NULL) {
+        st->cursor = idx;
+        st->done = 1;
+    } else if (record->header.type == SOCK_TRACE_SEND) {
+        /* The app waits for a response to a request it has not sent yet,
+         * e.g. MQTT waits for a message before its PINGREQ. Nothing
+         * arrives until the recorded time of the request. */
+        if (!m_realtime) {
+            prv_wait_send();
+        } else if (st->offset == 0) {
+            prv_wait_until(record);
+        }
+        blocked = 1;
+        ret = KHC_SOCK_AGAIN;
+    } else if (record->header.type == SOCK_TRACE_RECV_AGAIN
+            || record->header.type == SOCK_TRACE_RECV_FAIL) {
+        prv_wait_until(record);
+        st->cursor = idx + 1;
+        st->offset = 0;
+        ret = record->header.type == SOCK_TRACE_RECV_AGAIN ?
+            KHC_SOCK_AGAIN : KHC_SOCK_FAIL;
+    } else if (record->header.type == SOCK_TRACE_RECV) {
+        if (st->offset == 0) {
+            prv_wait_until(record);
+        }
+        size_t n = record->header.length - st->offset;
+        if (n > length_to_read) {
+            n = length_to_read;
+        }
+        memcpy(buffer, &record->data[st->offset], n);
+        st->offset += n;
+        if (st->offset == record->header.length) {
+            st->cursor = idx + 1;
+            st->offset = 0;
+        }
+        *out_actual_length = n;
+    }
+    /* Otherwise the recorded connection ends here: 0 bytes read. */
+
+    pthread_mutex_lock(&m_trace_mutex);
+    m_stats.recv_bytes += *out_actual_length;
+    m_stats.recv_blocked += blocked;
+    pthread_mutex_unlock(&m_trace_mutex);
+    return ret;
+}
+
+khc_sock_code_t
+    sock_replay_close(void* sock_ctx)
+{
+    return KHC_SOCK_OK;
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
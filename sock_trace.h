@@ -0,0 +1,125 @@
+#ifndef __SOCK_TRACE
+#define __SOCK_TRACE
+
+#include <khc_socket_callback.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Trace file is a header followed by records:
+ *
+ *   header: "SKTR" | uint32 version
+ *   record: uint8 type | uint8 stream | uint16 reserved | uint32 length
+ *           | uint64 time in microseconds from start | data[length]
+ *
+ * Integers are in host byte order. Data of send/recv records is plaintext
+ * as passed through sock_cb_send()/sock_cb_recv(). A recv record of length
+ * 0 is a connection closed by the server. Data of a connect record is
+ * "host:port". Receives which timed out or failed have their own records
+ * without data, so that replay returns them at the same point.
+ */
+#define SOCK_TRACE_VERSION 2
+#define SOCK_TRACE_MAX_STREAMS 8
+/* In a fast replay, a receive waiting for the app to send the recorded
+ * request blocks this long at most, instead of returning at once, so that
+ * the receive loop of the SDK does not spin. */
+#define SOCK_TRACE_FAST_BLOCK_MS 10
+
+typedef enum {
+    SOCK_TRACE_CONNECT = 1,
+    SOCK_TRACE_SEND = 2,
+    SOCK_TRACE_RECV = 3,
+    SOCK_TRACE_CLOSE = 4,
+    /* sock_cb_recv() returned KHC_SOCK_AGAIN, e.g. a receive timeout. */
+    SOCK_TRACE_RECV_AGAIN = 5,
+    /* sock_cb_recv() returned KHC_SOCK_FAIL. */
+    SOCK_TRACE_RECV_FAIL = 6
+} sock_trace_type_t;
+
+typedef enum {
+    SOCK_TRACE_OFF,
+    SOCK_TRACE_RECORDING,
+    SOCK_TRACE_REPLAYING
+} sock_trace_mode_t;
+
+typedef struct {
+    unsigned long connects;
+    unsigned long sent_bytes;
+    unsigned long recv_bytes;
+    /* Sent bytes which differ from the trace. */
+    unsigned long send_mismatches;
+    /* Sent bytes beyond the recorded ones. */
+    unsigned long send_unexpected;
+    /* Recorded sent bytes never sent during replay. */
+    unsigned long send_missing;
+    /* Receives answered with KHC_SOCK_AGAIN during replay because the app
+     * had not sent the recorded request yet. */
+    unsigned long recv_blocked;
+} sock_trace_stats_t;
+
+/** Start recording all socket traffic to path. */
+int sock_trace_record_open(const char* path);
+
+/** Start replaying traffic from path.
+ *
+ * @param [in] path trace file made with sock_trace_record_open().
+ * @param [in] realtime non 0 to serve received data with recorded timing,
+ * 0 to serve it as fast as possible.
+ */
+int sock_trace_replay_open(const char* path, int realtime);
+
+/** Finish recording or replaying. */
+void sock_trace_close();
+
+sock_trace_mode_t sock_trace_mode();
+
+/** Append a record. Used by sock_cb_* while recording. */
+void sock_trace_record(
+        int stream,
+        sock_trace_type_t type,
+        const char* data,
+        size_t length);
+
+/** Returns non 0 once every stream of the replayed trace is consumed. */
+int sock_trace_replay_done();
+
+/** Returns non 0 while replaying as fast as possible. Delays of the app,
+ * such as the update period, are skipped then. */
+int sock_trace_replay_fast();
+
+void sock_trace_get_stats(sock_trace_stats_t* out_stats);
+
+/* Replay backend. sock_ctx is a socket_context_t, whose trace_stream
+ * selects the recorded stream.
+ *
+ * sock_replay_recv() returns the recorded results in order. While the
+ * next record of the stream is a send, the app has not sent the recorded
+ * request yet, so it returns KHC_SOCK_AGAIN as a receive timeout would,
+ * and the request stays to be compared when it is sent. It returns after
+ * the recorded time of the request, or in a fast replay after the next
+ * send of any stream or SOCK_TRACE_FAST_BLOCK_MS. */
+khc_sock_code_t
+    sock_replay_connect(void* sock_ctx, const char* host,
+            unsigned int port);
+
+khc_sock_code_t
+    sock_replay_send(void* sock_ctx,
+            const char* buffer,
+            size_t length,
+            size_t* out_sent_length);
+
+khc_sock_code_t
+    sock_replay_recv(void* sock_ctx, char* buffer, size_t length_to_read,
+            size_t* out_actual_length);
+
+khc_sock_code_t
+    sock_replay_close(void* sock_ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SOCK_TRACE */
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,243 @@
+#include "state_encoding.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+int state_encoding_parse(const char* name, state_encoding_t* out_encoding)
+{
+    if (strcmp(name, "json") == 0) {
+        *out_encoding = STATE_ENCODING_JSON;
+    } else if (strcmp(name, "deflate") == 0) {
+        *out_encoding = STATE_ENCODING_DEFLATE;
+    } else if (strcmp(name, "cbor") == 0) {
+        *out_encoding = STATE_ENCODING_CBOR;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char* state_encoding_name(state_encoding_t encoding)
+{
+    switch (encoding) {
+        case STATE_ENCODING_DEFLATE:
+            return "deflate";
+        case STATE_ENCODING_CBOR:
+            return "cbor";
+        default:
+            return "json";
+    }
+}
+
+static void prv_append(state_encoder_t* enc, const void* data, size_t len)
+{
+    if (enc->error || enc->len + len > enc->buff_size) {
+        enc->error = 1;
+        return;
+    }
+    memcpy(&enc->buff[enc->len], data, len);
+    enc->len += len;
+}
+
+/* CBOR head: major type and argument in the shortest form. */
+static void prv_cbor_head(state_encoder_t* enc, uint8_t major, uint64_t arg)
+{
+    uint8_t head[9];
+    size_t len;
+
+    if (arg < 24) {
+        head[0] = (major << 5) | arg;
+        len = 1;
+    } else if (arg <= 0xff) {
+        head[0] = (major << 5) | 24;
+        head[1] = arg;
+        len = 2;
+    } else if (arg <= 0xffff) {
+        head[0] = (major << 5) | 25;
+        head[1] = arg >> 8;
+        head[2] = arg;
+        len = 3;
+    } else if (arg <= 0xffffffff) {
+        head[0] = (major << 5) | 26;
+        for (int i = 0; i < 4; ++i) {
+            head[1 + i] = arg >> (24 - 8 * i);
+        }
+        len = 5;
+    } else {
+        head[0] = (major << 5) | 27;
+        for (int i = 0; i < 8; ++i) {
+            head[1 + i] = arg >> (56 - 8 * i);
+        }
+        len = 9;
+    }
+    prv_append(enc, head, len);
+}
+
+static void prv_key(state_encoder_t* enc, const char* key)
+{
+    if (enc->encoding == STATE_ENCODING_CBOR) {
+        if (key != NULL) {
+            size_t len = strlen(key);
+            prv_cbor_head(enc, 3, len);
+            prv_append(enc, key, len);
+        }
+        return;
+    }
+    if (enc->depth > 0) {
+        if (!enc->first[enc->depth - 1]) {
+            prv_append(enc, ",", 1);
+        }
+        enc->first[enc->depth - 1] = 0;
+    }
+    if (key != NULL) {
+        prv_append(enc, "\"", 1);
+        prv_append(enc, key, strlen(key));
+        prv_append(enc, "\":", 2);
+    }
+}
+
+void state_encoder_init(
+        state_encoder_t* enc,
+        state_encoding_t encoding,
+        char* out,
+        size_t out_size,
+        char* work,
+        size_t work_size)
+{
+    memset(enc, 0, sizeof(*enc));
+    enc->encoding = encoding;
+    enc->out = out;
+    enc->out_size = out_size;
+    enc->work = work;
+    enc->work_size = work_size;
+    if (encoding == STATE_ENCODING_DEFLATE) {
+        if (work == NULL || work_size <= STATE_ENCODING_ZLIB_MEM_SIZE) {
+            enc->error = 1;
+            return;
+        }
+        enc->buff = work + STATE_ENCODING_ZLIB_MEM_SIZE;
+        enc->buff_size = work_size - STATE_ENCODING_ZLIB_MEM_SIZE;
+    } else {
+        enc->buff = out;
+        enc->buff_size = out_size;
+    }
+}
+
+void state_encoder_begin_map(state_encoder_t* enc, const char* key)
+{
+    prv_key(enc, key);
+    if (enc->depth >= STATE_ENCODING_MAX_DEPTH) {
+        enc->error = 1;
+        return;
+    }
+    enc->first[enc->depth++] = 1;
+    if (enc->encoding == STATE_ENCODING_CBOR) {
+        /* Indefinite length map. */
+        uint8_t head = 0xbf;
+        prv_append(enc, &head, 1);
+    } else {
+        prv_append(enc, "{", 1);
+    }
+}
+
+void state_encoder_put_bool(state_encoder_t* enc, const char* key, int value)
+{
+    prv_key(enc, key);
+    if (enc->encoding == STATE_ENCODING_CBOR) {
+        uint8_t simple = value ? 0xf5 : 0xf4;
+        prv_append(enc, &simple, 1);
+    } else if (value) {
+        prv_append(enc, "true", 4);
+    } else {
+        prv_append(enc, "false", 5);
+    }
+}
+
+void state_encoder_put_int(state_encoder_t* enc, const char* key, long value)
+{
+    prv_key(enc, key);
+    if (enc->encoding == STATE_ENCODING_CBOR) {
+        if (value >= 0) {
+            prv_cbor_head(enc, 0, (uint64_t)value);
+        } else {
+            prv_cbor_head(enc, 1, (uint64_t)(-1 - value));
+        }
+    } else {
+        char num[24];
+        int len = snprintf(num, sizeof(num), "%ld", value);
+        prv_append(enc, num, len);
+    }
+}
+
+void state_encoder_end_map(state_encoder_t* enc)
+{
+    if (enc->depth == 0) {
+        enc->error = 1;
+        return;
+    }
+    enc->depth--;
+    if (enc->encoding == STATE_ENCODING_CBOR) {
+        uint8_t brk = 0xff;
+        prv_append(enc, &brk, 1);
+    } else {
+        prv_append(enc, "}", 1);
+    }
+}
+
+/* zlib allocates from the head of the work area only. */
+static voidpf prv_zalloc(voidpf opaque, uInt items, uInt size)
+{
+    state_encoder_t* enc = (state_encoder_t*)opaque;
+    size_t bytes = ((size_t)items * size + 15) & ~(size_t)15;
+    if (enc->work_used + bytes > STATE_ENCODING_ZLIB_MEM_SIZE) {
+        return Z_NULL;
+    }
+    voidpf ptr = enc->work + enc->work_used;
+    enc->work_used += bytes;
+    return ptr;
+}
+
+static void prv_zfree(voidpf opaque, voidpf address)
+{
+    /* Everything is released with the work area. */
+}
+
+static size_t prv_deflate(state_encoder_t* enc)
+{
+    z_stream stream;
+
+    memset(&stream, 0, sizeof(stream));
+    stream.zalloc = prv_zalloc;
+    stream.zfree = prv_zfree;
+    stream.opaque = enc;
+    enc->work_used = 0;
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED,
+                STATE_ENCODING_ZLIB_WINDOW_BITS,
+                STATE_ENCODING_ZLIB_MEM_LEVEL,
+                Z_DEFAULT_STRATEGY) != Z_OK) {
+        return 0;
+    }
+    stream.next_in = (Bytef*)enc->buff;
+    stream.avail_in = enc->len;
+    stream.next_out = (Bytef*)enc->out;
+    stream.avail_out = enc->out_size;
+    int ret = deflate(&stream, Z_FINISH);
+    size_t len = stream.total_out;
+    deflateEnd(&stream);
+    return ret == Z_STREAM_END ? len : 0;
+}
+
+size_t state_encoder_finish(state_encoder_t* enc)
+{
+    if (enc->error || enc->depth != 0) {
+        return 0;
+    }
+    if (enc->encoding == STATE_ENCODING_DEFLATE) {
+        return prv_deflate(enc);
+    }
+    return enc->len;
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
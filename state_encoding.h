@@ -0,0 +1,89 @@
+#ifndef __STATE_ENCODING
+#define __STATE_ENCODING
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    STATE_ENCODING_JSON,
+    /* JSON compressed in zlib format (HTTP Content-Encoding: deflate). */
+    STATE_ENCODING_DEFLATE,
+    /* CBOR (RFC 7049) with indefinite length maps. */
+    STATE_ENCODING_CBOR
+} state_encoding_t;
+
+/* Deflate window and hash sizes are the smallest zlib allows, so that the
+ * compressor fits in the work area. */
+#define STATE_ENCODING_ZLIB_WINDOW_BITS 9
+#define STATE_ENCODING_ZLIB_MEM_LEVEL 1
+#define STATE_ENCODING_ZLIB_MEM_SIZE (12 * 1024)
+
+#define STATE_ENCODING_MAX_DEPTH 4
+
+typedef struct {
+    state_encoding_t encoding;
+    char* out;
+    size_t out_size;
+    /* JSON before compression, and memory of zlib. */
+    char* work;
+    size_t work_size;
+    size_t work_used;
+    /* Where JSON/CBOR is written: out, or work for deflate. */
+    char* buff;
+    size_t buff_size;
+    size_t len;
+    int depth;
+    int first[STATE_ENCODING_MAX_DEPTH];
+    int error;
+} state_encoder_t;
+
+/** Parse name of encoding: "json", "deflate" or "cbor".
+ *
+ * @return 0 if succeeded, otherwise -1.
+ */
+int state_encoding_parse(const char* name, state_encoding_t* out_encoding);
+
+const char* state_encoding_name(state_encoding_t encoding);
+
+/** Prepare encoder.
+ *
+ * @param [out] enc encoder.
+ * @param [in] encoding encoding of output.
+ * @param [out] out buffer for encoded state.
+ * @param [in] out_size size of out.
+ * @param [in] work work area. Required for STATE_ENCODING_DEFLATE, and
+ * must be bigger than uncompressed JSON + STATE_ENCODING_ZLIB_MEM_SIZE.
+ * @param [in] work_size size of work.
+ */
+void state_encoder_init(
+        state_encoder_t* enc,
+        state_encoding_t encoding,
+        char* out,
+        size_t out_size,
+        char* work,
+        size_t work_size);
+
+/** Open a map. key is NULL for the root map. */
+void state_encoder_begin_map(state_encoder_t* enc, const char* key);
+
+void state_encoder_put_bool(state_encoder_t* enc, const char* key, int value);
+
+void state_encoder_put_int(state_encoder_t* enc, const char* key, long value);
+
+void state_encoder_end_map(state_encoder_t* enc);
+
+/** Complete encoding.
+ *
+ * @return length of encoded state in out, or 0 if it does not fit.
+ */
+size_t state_encoder_finish(state_encoder_t* enc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STATE_ENCODING */
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
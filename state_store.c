@@ -0,0 +1,93 @@
+#include "state_store.h"
+
+#include <sched.h>
+#include <string.h>
+
+void state_store_init(state_store_t* store)
+{
+    memset(store, 0, sizeof(*store));
+    atomic_init(&store->seq, 0);
+    atomic_init(&store->power, 0);
+    atomic_init(&store->temperature, 0);
+    pthread_mutex_init(&store->write_mutex, NULL);
+}
+
+int state_store_subscribe(
+        state_store_t* store,
+        unsigned int fields,
+        STATE_STORE_CHANGE_CB cb,
+        void* userdata)
+{
+    if (store->subscriber_num >= STATE_STORE_MAX_SUBSCRIBERS) {
+        return -1;
+    }
+    state_store_subscriber_t* sub = &store->subscribers[store->subscriber_num++];
+    sub->fields = fields;
+    sub->cb = cb;
+    sub->userdata = userdata;
+    return 0;
+}
+
+void state_store_read(state_store_t* store, device_state_t* out_state)
+{
+    unsigned long seq1, seq2;
+
+    do {
+        seq1 = atomic_load_explicit(&store->seq, memory_order_acquire);
+        if (seq1 & 1) {
+            /* A writer is in the middle of an update. */
+            sched_yield();
+            continue;
+        }
+        out_state->power =
+            atomic_load_explicit(&store->power, memory_order_relaxed);
+        out_state->temperature =
+            atomic_load_explicit(&store->temperature, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        seq2 = atomic_load_explicit(&store->seq, memory_order_relaxed);
+    } while ((seq1 & 1) || seq1 != seq2);
+    out_state->version = seq1 / 2;
+}
+
+static int prv_write(state_store_t* store, atomic_int* field, int value,
+        unsigned int field_bit)
+{
+    device_state_t state;
+
+    pthread_mutex_lock(&store->write_mutex);
+    if (atomic_load_explicit(field, memory_order_relaxed) == value) {
+        pthread_mutex_unlock(&store->write_mutex);
+        return 0;
+    }
+    unsigned long seq = atomic_load_explicit(&store->seq, memory_order_relaxed);
+    atomic_store_explicit(&store->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(field, value, memory_order_relaxed);
+    atomic_store_explicit(&store->seq, seq + 2, memory_order_release);
+
+    state.power = atomic_load_explicit(&store->power, memory_order_relaxed);
+    state.temperature =
+        atomic_load_explicit(&store->temperature, memory_order_relaxed);
+    state.version = (seq + 2) / 2;
+    pthread_mutex_unlock(&store->write_mutex);
+
+    for (int i = 0; i < store->subscriber_num; ++i) {
+        state_store_subscriber_t* sub = &store->subscribers[i];
+        if (sub->fields & field_bit) {
+            sub->cb(&state, field_bit, sub->userdata);
+        }
+    }
+    return 1;
+}
+
+int state_store_set_power(state_store_t* store, int power)
+{
+    return prv_write(store, &store->power, power, STATE_FIELD_POWER);
+}
+
+int state_store_set_temperature(state_store_t* store, int temperature)
+{
+    return prv_write(store, &store->temperature, temperature, STATE_FIELD_TEMPERATURE);
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,82 @@
+#ifndef __STATE_STORE
+#define __STATE_STORE
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STATE_STORE_MAX_SUBSCRIBERS 4
+
+/* Bits of fields, to tell which fields are changed. */
+#define STATE_FIELD_POWER 0x01
+#define STATE_FIELD_TEMPERATURE 0x02
+
+typedef struct {
+    int power;
+    int temperature;
+    /* Incremented on each change. */
+    unsigned long version;
+} device_state_t;
+
+/** Called after a change, on the thread which made it.
+ *
+ * @param [in] state state after the change.
+ * @param [in] changed STATE_FIELD_* bits of changed fields.
+ * @param [in] userdata userdata given to state_store_subscribe().
+ */
+typedef void (*STATE_STORE_CHANGE_CB)(
+        const device_state_t* state,
+        unsigned int changed,
+        void* userdata);
+
+typedef struct {
+    unsigned int fields;
+    STATE_STORE_CHANGE_CB cb;
+    void* userdata;
+} state_store_subscriber_t;
+
+/* Readers never block: they retry while a write is in progress
+ * (sequence lock). Writers are serialized by write_mutex. */
+typedef struct {
+    atomic_ulong seq;
+    atomic_int power;
+    atomic_int temperature;
+    pthread_mutex_t write_mutex;
+    state_store_subscriber_t subscribers[STATE_STORE_MAX_SUBSCRIBERS];
+    int subscriber_num;
+} state_store_t;
+
+void state_store_init(state_store_t* store);
+
+/** Register a change callback for some fields.
+ *
+ * Must be called before the store is shared between threads.
+ *
+ * @return 0 if succeeded, otherwise -1.
+ */
+int state_store_subscribe(
+        state_store_t* store,
+        unsigned int fields,
+        STATE_STORE_CHANGE_CB cb,
+        void* userdata);
+
+/** Read a consistent snapshot. */
+void state_store_read(state_store_t* store, device_state_t* out_state);
+
+/** Set a field. Subscribers are called only if the value changes.
+ *
+ * @return 1 if the value is changed, 0 if it is the same.
+ */
+int state_store_set_power(state_store_t* store, int power);
+
+int state_store_set_temperature(state_store_t* store, int temperature);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STATE_STORE */
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -9,14 +9,67 @@
 extern "C" {
 #endif
 
+/* Peers whose address and TLS session are cached. The SDK connects to the
+ * app host and its MQTT endpoint only. A peer with open connections is not
+ * replaced; when all are open, other hosts are connected without caching. */
+#define SOCK_PEER_CACHE_SIZE 4
+/* Resolved addresses are reused for this long. */
+#define SOCK_DNS_TTL_SEC 300
+/* Max wait for a free connection of the pool. */
+#define SOCK_POOL_WAIT_SEC 60
+
+typedef struct {
+    /* Max pooled connections open at once. 0 for no limit. */
+    int max_pooled_connections;
+    /* Connect to this host and port instead of the ones given by the SDK,
+     * e.g. a local mock server. NULL not to override. */
+    const char* connect_to_host;
+    unsigned int connect_to_port;
+    /* Free TLS buffers while a connection is idle. Saves memory when many
+     * connections are kept open. */
+    int release_buffers;
+} sock_cb_config_t;
+
+typedef struct {
+    unsigned long connects;
+    unsigned long connect_failures;
+    /* Handshakes which resumed a cached TLS session. */
+    unsigned long resumed;
+    unsigned long dns_lookups;
+    unsigned long dns_hits;
+    int open;
+    int peak_open;
+    int pooled_open;
+    /* Connects which had to wait for a free pooled connection. */
+    unsigned long pool_waits;
+} sock_cb_stats_t;
+
 typedef struct {
     SSL *ssl;
     SSL_CTX *ssl_ctx;
     int socket;
     unsigned int to_recv;
     unsigned int to_send;
+    /* Set to 1 to watch HTTP responses for 401 Unauthorized. */
+    int check_auth;
+    /* Set by sock_cb_recv when the server rejected the access token. */
+    volatile int auth_rejected;
+    /* Set when a request is sent and cleared when its status is seen. */
+    int response_pending;
+    /* Stream id of this connection in socket traces. See sock_trace.h */
+    int trace_stream;
+    /* Set to 1 for short-lived connections counted in the pool.
+     * See sock_cb_config_t#max_pooled_connections */
+    int pooled;
+    /* Set while this connection holds a slot of the pool. */
+    int pool_slot;
 } socket_context_t;
 
+/** Configure connections. Call before the first connect. */
+void sock_cb_configure(const sock_cb_config_t* config);
+
+void sock_cb_get_stats(sock_cb_stats_t* out_stats);
+
 khc_sock_code_t
     sock_cb_connect(void* sock_ctx, const char* host,
             unsigned int port);
@@ -31,6 +84,7 @@ khc_sock_code_t
     sock_cb_recv(void* sock_ctx, char* buffer, size_t length_to_read,
             size_t* out_actual_length);
 
+/** Close the connection. Does nothing if it is already closed. */
 khc_sock_code_t
     sock_cb_close(void* sock_context);
 
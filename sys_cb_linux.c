@@ -12,8 +12,12 @@
 #include <openssl/crypto.h>
 #include <openssl/err.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "linux-env/task_impl.h"
+#include "sock_trace.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <stdarg.h>
@@ -24,36 +28,309 @@
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
 #endif
 
+static pthread_once_t m_init_once = PTHREAD_ONCE_INIT;
+static SSL_CTX* m_ssl_ctx = NULL;
+static sock_cb_config_t m_config;
+
+typedef struct {
+    char host[128];
+    unsigned int port;
+    struct sockaddr_in addr;
+    /* CLOCK_MONOTONIC seconds of the last lookup, 0 if not resolved. */
+    time_t resolved_at;
+    /* Set while a connect looks the host up. Others wait on
+     * m_resolve_cond instead of looking it up too. */
+    int resolving;
+    /* Connects in progress and open connections of the peer. Their SSL
+     * objects point to the peer, so it is not evicted while referenced. */
+    int refs;
+    /* Session to resume on the next connect. */
+    SSL_SESSION* session;
+} prv_peer_t;
+
+/* Peers, pool and stats are guarded by m_mutex. */
+static pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m_pool_cond;
+static pthread_cond_t m_resolve_cond = PTHREAD_COND_INITIALIZER;
+static prv_peer_t m_peers[SOCK_PEER_CACHE_SIZE];
+static int m_peer_num = 0;
+static int m_peer_next = 0;
+static sock_cb_stats_t m_stats;
+
+static time_t prv_now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* Keep the latest session of each peer. With TLS 1.3 it arrives after the
+ * handshake, so this is called from SSL_read() too. */
+static int prv_new_session_cb(SSL* ssl, SSL_SESSION* session)
+{
+    prv_peer_t* peer = (prv_peer_t*)SSL_get_app_data(ssl);
+    if (peer == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&m_mutex);
+    if (peer->session != NULL) {
+        SSL_SESSION_free(peer->session);
+    }
+    peer->session = session;
+    pthread_mutex_unlock(&m_mutex);
+    return 1;
+}
+
+/* One SSL_CTX is shared by all connections, so that it is not allocated
+ * and configured again on each reconnect. */
+static void prv_init()
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m_pool_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    SSL_library_init();
+    const SSL_METHOD *method =
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
+        TLSv1_2_client_method();
+#else
+        TLS_client_method();
+#endif
+    m_ssl_ctx = SSL_CTX_new(method);
+    if (m_ssl_ctx == NULL) {
+        return;
+    }
+    SSL_CTX_set_session_cache_mode(m_ssl_ctx,
+            SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(m_ssl_ctx, prv_new_session_cb);
+    if (m_config.release_buffers) {
+        SSL_CTX_set_mode(m_ssl_ctx, SSL_MODE_RELEASE_BUFFERS);
+    }
+}
+
+void sock_cb_configure(const sock_cb_config_t* config)
+{
+    m_config = *config;
+}
+
+void sock_cb_get_stats(sock_cb_stats_t* out_stats)
+{
+    pthread_mutex_lock(&m_mutex);
+    *out_stats = m_stats;
+    pthread_mutex_unlock(&m_mutex);
+}
+
+/* Take a reference to the peer of host and port, replacing a peer which
+ * is not referenced if it is not cached. Returns NULL if all peers are
+ * referenced. */
+static prv_peer_t* prv_get_peer(const char* host, unsigned int port)
+{
+    prv_peer_t* peer = NULL;
+
+    pthread_mutex_lock(&m_mutex);
+    for (int i = 0; i < m_peer_num; ++i) {
+        if (m_peers[i].port == port && strcmp(m_peers[i].host, host) == 0) {
+            peer = &m_peers[i];
+            peer->refs++;
+            pthread_mutex_unlock(&m_mutex);
+            return peer;
+        }
+    }
+    if (m_peer_num < SOCK_PEER_CACHE_SIZE) {
+        peer = &m_peers[m_peer_num++];
+    } else {
+        for (int i = 0; i < SOCK_PEER_CACHE_SIZE && peer == NULL; ++i) {
+            prv_peer_t* candidate = &m_peers[m_peer_next];
+            m_peer_next = (m_peer_next + 1) % SOCK_PEER_CACHE_SIZE;
+            if (candidate->refs == 0) {
+                peer = candidate;
+            }
+        }
+        if (peer == NULL) {
+            pthread_mutex_unlock(&m_mutex);
+            return NULL;
+        }
+        if (peer->session != NULL) {
+            SSL_SESSION_free(peer->session);
+        }
+    }
+    memset(peer, 0, sizeof(*peer));
+    strncpy(peer->host, host, sizeof(peer->host) - 1);
+    peer->port = port;
+    peer->refs = 1;
+    pthread_mutex_unlock(&m_mutex);
+    return peer;
+}
+
+static void prv_put_peer(prv_peer_t* peer)
+{
+    if (peer == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&m_mutex);
+    peer->refs--;
+    pthread_mutex_unlock(&m_mutex);
+}
+
+static int prv_lookup(const char* host, unsigned int port,
+        struct sockaddr_in* out_addr)
+{
+    struct addrinfo hints;
+    struct addrinfo* res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+        return -1;
+    }
+    memcpy(out_addr, res->ai_addr, sizeof(*out_addr));
+    freeaddrinfo(res);
+    out_addr->sin_port = htons(port);
+    return 0;
+}
+
+/* Cached address of the peer, or look it up without holding m_mutex.
+ * Concurrent connects to the same peer wait for one lookup. peer is NULL
+ * when all peers are referenced, then the address is not cached. */
+static int prv_resolve(prv_peer_t* peer, const char* host, unsigned int port,
+        struct sockaddr_in* out_addr)
+{
+    struct sockaddr_in addr;
+
+    pthread_mutex_lock(&m_mutex);
+    while (peer != NULL && peer->resolving) {
+        pthread_cond_wait(&m_resolve_cond, &m_mutex);
+    }
+    if (peer != NULL && peer->resolved_at != 0
+            && prv_now_sec() - peer->resolved_at < SOCK_DNS_TTL_SEC) {
+        m_stats.dns_hits++;
+        *out_addr = peer->addr;
+        pthread_mutex_unlock(&m_mutex);
+        return 0;
+    }
+    m_stats.dns_lookups++;
+    if (peer != NULL) {
+        peer->resolving = 1;
+    }
+    pthread_mutex_unlock(&m_mutex);
+
+    int ret = prv_lookup(host, port, &addr);
+    if (peer != NULL) {
+        pthread_mutex_lock(&m_mutex);
+        peer->resolving = 0;
+        if (ret == 0) {
+            peer->addr = addr;
+            peer->resolved_at = prv_now_sec();
+        }
+        pthread_cond_broadcast(&m_resolve_cond);
+        pthread_mutex_unlock(&m_mutex);
+    }
+    if (ret == 0) {
+        *out_addr = addr;
+    }
+    return ret;
+}
+
+static int prv_pool_acquire(socket_context_t* ctx)
+{
+    struct timespec deadline;
+
+    ctx->pool_slot = 0;
+    if (!ctx->pooled || m_config.max_pooled_connections <= 0) {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += SOCK_POOL_WAIT_SEC;
+
+    pthread_mutex_lock(&m_mutex);
+    if (m_stats.pooled_open >= m_config.max_pooled_connections) {
+        m_stats.pool_waits++;
+    }
+    while (m_stats.pooled_open >= m_config.max_pooled_connections) {
+        if (pthread_cond_timedwait(&m_pool_cond, &m_mutex, &deadline) != 0) {
+            pthread_mutex_unlock(&m_mutex);
+            return -1;
+        }
+    }
+    m_stats.pooled_open++;
+    ctx->pool_slot = 1;
+    pthread_mutex_unlock(&m_mutex);
+    return 0;
+}
+
+static void prv_pool_release(socket_context_t* ctx)
+{
+    if (!ctx->pool_slot) {
+        return;
+    }
+    pthread_mutex_lock(&m_mutex);
+    m_stats.pooled_open--;
+    ctx->pool_slot = 0;
+    pthread_cond_signal(&m_pool_cond);
+    pthread_mutex_unlock(&m_mutex);
+}
+
+static khc_sock_code_t prv_connect_failed(socket_context_t* ctx, int sock,
+        SSL* ssl, prv_peer_t* peer)
+{
+    if (ssl != NULL) {
+        SSL_free(ssl);
+    }
+    if (sock >= 0) {
+        close(sock);
+    }
+    prv_put_peer(peer);
+    prv_pool_release(ctx);
+    pthread_mutex_lock(&m_mutex);
+    m_stats.connect_failures++;
+    pthread_mutex_unlock(&m_mutex);
+    return KHC_SOCK_FAIL;
+}
+
 khc_sock_code_t
     sock_cb_connect(void* sock_ctx, const char* host,
             unsigned int port)
 {
     int sock, ret;
-    struct hostent *servhost;
     struct sockaddr_in server;
     SSL *ssl = NULL;
     SSL_CTX *ssl_ctx = NULL;
+    prv_peer_t* peer;
 
-    servhost = gethostbyname(host);
-    if (servhost == NULL) {
-        printf("failed to get host.\n");
-        return KHC_SOCK_FAIL;
+    if (sock_trace_mode() == SOCK_TRACE_REPLAYING) {
+        return sock_replay_connect(sock_ctx, host, port);
+    }
+
+    pthread_once(&m_init_once, prv_init);
+    socket_context_t* ctx = (socket_context_t*)sock_ctx;
+    if (prv_pool_acquire(ctx) != 0) {
+        printf("no free connection in pool.\n");
+        return prv_connect_failed(ctx, -1, NULL, NULL);
     }
-    memset(&server, 0x00, sizeof(server));
-    server.sin_family = AF_INET;
-    /* More secure. */
-    memcpy(&(server.sin_addr), servhost->h_addr, servhost->h_length);
 
-    /* Get Port number */
-    server.sin_port = htons(port);
+    const char* peer_host = host;
+    unsigned int peer_port = port;
+    if (m_config.connect_to_host != NULL) {
+        peer_host = m_config.connect_to_host;
+        if (m_config.connect_to_port != 0) {
+            peer_port = m_config.connect_to_port;
+        }
+    }
+    peer = prv_get_peer(peer_host, peer_port);
+    if (prv_resolve(peer, peer_host, peer_port, &server) != 0) {
+        printf("failed to get host.\n");
+        return prv_connect_failed(ctx, -1, NULL, peer);
+    }
 
     sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) {
         printf("failed to init socket.\n");
-        return KHC_SOCK_FAIL;
+        return prv_connect_failed(ctx, -1, NULL, peer);
     }
 
-    socket_context_t* ctx = (socket_context_t*)sock_ctx;
     if (ctx->to_recv > 0) {
         struct timeval tv;
         tv.tv_sec = ctx->to_recv;
@@ -70,33 +347,40 @@ khc_sock_code_t
 
     if (connect(sock, (struct sockaddr*) &server, sizeof(server)) == -1 ){
         printf("failed to connect socket.\n");
-        return KHC_SOCK_FAIL;
+        // The address may have changed. Look it up again next time.
+        if (peer != NULL) {
+            pthread_mutex_lock(&m_mutex);
+            peer->resolved_at = 0;
+            pthread_mutex_unlock(&m_mutex);
+        }
+        return prv_connect_failed(ctx, sock, NULL, peer);
     }
 
-    SSL_library_init();
-    const SSL_METHOD *method =
-#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
-        TLSv1_2_client_method();
-#else
-        TLS_client_method();
-#endif
-    ssl_ctx = SSL_CTX_new(method);
+    ssl_ctx = m_ssl_ctx;
     if (ssl_ctx == NULL){
         printf("failed to init ssl context.\n");
-        return KHC_SOCK_FAIL;
+        return prv_connect_failed(ctx, sock, NULL, peer);
     }
 
     ssl = SSL_new(ssl_ctx);
     if (ssl == NULL){
         printf("failed to init ssl.\n");
-        return KHC_SOCK_FAIL;
+        return prv_connect_failed(ctx, sock, NULL, peer);
     }
 
     ret = SSL_set_fd(ssl, sock);
     if (ret == 0){
         printf("failed to set fd.\n");
-        return KHC_SOCK_FAIL;
+        return prv_connect_failed(ctx, sock, ssl, peer);
+    }
+
+    // The reference to peer is released when ssl is freed.
+    SSL_set_app_data(ssl, peer);
+    pthread_mutex_lock(&m_mutex);
+    if (peer != NULL && peer->session != NULL) {
+        SSL_set_session(ssl, peer->session);
     }
+    pthread_mutex_unlock(&m_mutex);
 
     ret = SSL_connect(ssl);
     if (ret != 1) {
@@ -104,15 +388,47 @@ khc_sock_code_t
         char sslErrStr[120];
         ERR_error_string_n(sslErr, sslErrStr, 120);
         printf("failed to connect: %s\n", sslErrStr);
-        return KHC_SOCK_FAIL;
+        return prv_connect_failed(ctx, sock, ssl, peer);
     }
 
+    pthread_mutex_lock(&m_mutex);
+    m_stats.connects++;
+    if (SSL_session_reused(ssl)) {
+        m_stats.resumed++;
+    }
+    if (++m_stats.open > m_stats.peak_open) {
+        m_stats.peak_open = m_stats.open;
+    }
+    pthread_mutex_unlock(&m_mutex);
+
     ctx->socket = sock;
+    ctx->response_pending = 0;
     ctx->ssl = ssl;
     ctx->ssl_ctx = ssl_ctx;
+    if (sock_trace_mode() == SOCK_TRACE_RECORDING) {
+        char peer_name[300];
+        int len = snprintf(peer_name, sizeof(peer_name), "%s:%u", host, port);
+        sock_trace_record(ctx->trace_stream, SOCK_TRACE_CONNECT, peer_name,
+                len < sizeof(peer_name) ? len : sizeof(peer_name) - 1);
+    }
     return KHC_SOCK_OK;
 }
 
+/* Status line of the first chunk of a response: "HTTP/1.1 401 ...".
+ * Only 401 means the access token is invalid. 403 is returned for a valid
+ * token without permission, which onboarding again does not fix. */
+static void prv_check_auth(socket_context_t* ctx, const char* buffer,
+        size_t length)
+{
+    ctx->response_pending = 0;
+    if (length < 12 || strncmp(buffer, "HTTP/1.", 7) != 0) {
+        return;
+    }
+    if (strncmp(&buffer[9], "401", 3) == 0) {
+        ctx->auth_rejected = 1;
+    }
+}
+
 khc_sock_code_t
     sock_cb_send(void* socket_context,
             const char* buffer,
@@ -120,8 +436,14 @@ khc_sock_code_t
             size_t* out_sent_length)
 {
     socket_context_t* ctx = (socket_context_t*)socket_context;
+    if (sock_trace_mode() == SOCK_TRACE_REPLAYING) {
+        return sock_replay_send(socket_context, buffer, length,
+                out_sent_length);
+    }
     int ret = SSL_write(ctx->ssl, buffer, length);
     if (ret > 0) {
+        ctx->response_pending = 1;
+        sock_trace_record(ctx->trace_stream, SOCK_TRACE_SEND, buffer, ret);
         *out_sent_length = ret;
         return KHC_SOCK_OK;
     } else {
@@ -130,13 +452,9 @@ khc_sock_code_t
     }
 }
 
-khc_sock_code_t
-    sock_cb_recv(void* socket_context,
-            char* buffer,
-            size_t length_to_read,
-            size_t* out_actual_length)
+static khc_sock_code_t prv_ssl_recv(socket_context_t* ctx, char* buffer,
+        size_t length_to_read, size_t* out_actual_length)
 {
-    socket_context_t* ctx = (socket_context_t*)socket_context;
     *out_actual_length = 0;
     int ret = SSL_read(ctx->ssl, buffer, length_to_read);
     if (ret > 0) {
@@ -164,10 +482,54 @@ khc_sock_code_t
     }
 }
 
+khc_sock_code_t
+    sock_cb_recv(void* socket_context,
+            char* buffer,
+            size_t length_to_read,
+            size_t* out_actual_length)
+{
+    socket_context_t* ctx = (socket_context_t*)socket_context;
+    if (sock_trace_mode() == SOCK_TRACE_REPLAYING) {
+        khc_sock_code_t res = sock_replay_recv(socket_context, buffer,
+                length_to_read, out_actual_length);
+        if (*out_actual_length > 0) {
+            trace_note_recv();
+        }
+        return res;
+    }
+    khc_sock_code_t res = prv_ssl_recv(ctx, buffer, length_to_read,
+            out_actual_length);
+    if (res == KHC_SOCK_OK) {
+        if (*out_actual_length > 0) {
+            if (ctx->check_auth && ctx->response_pending) {
+                prv_check_auth(ctx, buffer, *out_actual_length);
+            }
+            trace_note_recv();
+        }
+        // 0 bytes: closed by the server.
+        sock_trace_record(ctx->trace_stream, SOCK_TRACE_RECV, buffer,
+                *out_actual_length);
+    } else {
+        // Timeouts and errors are replayed at the same point.
+        sock_trace_record(ctx->trace_stream,
+                res == KHC_SOCK_AGAIN ?
+                SOCK_TRACE_RECV_AGAIN : SOCK_TRACE_RECV_FAIL,
+                NULL, 0);
+    }
+    return res;
+}
+
 khc_sock_code_t
     sock_cb_close(void* socket_context)
 {
     socket_context_t* ctx = (socket_context_t*)socket_context;
+    if (sock_trace_mode() == SOCK_TRACE_REPLAYING) {
+        return sock_replay_close(socket_context);
+    }
+    if (ctx->ssl == NULL) {
+        return KHC_SOCK_OK;
+    }
+    sock_trace_record(ctx->trace_stream, SOCK_TRACE_CLOSE, NULL, 0);
     int ret = SSL_shutdown(ctx->ssl);
     if (ret != 1) {
         int sslErr = SSL_get_error(ctx->ssl, ret);
@@ -182,8 +544,15 @@ khc_sock_code_t
         }
     }
     close(ctx->socket);
+    prv_peer_t* peer = (prv_peer_t*)SSL_get_app_data(ctx->ssl);
     SSL_free(ctx->ssl);
-    SSL_CTX_free(ctx->ssl_ctx);
+    prv_put_peer(peer);
+    ctx->ssl = NULL;
+    ctx->socket = -1;
+    prv_pool_release(ctx);
+    pthread_mutex_lock(&m_mutex);
+    m_stats.open--;
+    pthread_mutex_unlock(&m_mutex);
     if (ret != 1) {
         printf("failed to close:\n");
         return KHC_SOCK_FAIL;
@@ -193,6 +562,10 @@ khc_sock_code_t
 
 void delay_ms_cb_impl(unsigned int msec, void* userdata)
 {
+    // Waits of the SDK are not part of what a fast replay measures.
+    if (sock_trace_replay_fast()) {
+        return;
+    }
     delay_ms_cb(msec, userdata);
 }
 
@@ -0,0 +1,76 @@
+/* Size and CPU time to encode the state, for the table in README.mkd.
+ * Run with: make bench */
+#include "state_encoding.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define ITERATIONS 100000
+
+static char m_out[4096];
+static char m_work[4096 + STATE_ENCODING_ZLIB_MEM_SIZE];
+
+/* The current state, and extra sensors with 3 integer fields each. */
+static size_t prv_encode(state_encoding_t encoding, int sensors)
+{
+    state_encoder_t enc;
+    char key[16];
+
+    state_encoder_init(&enc, encoding, m_out, sizeof(m_out), m_work,
+            sizeof(m_work));
+    state_encoder_begin_map(&enc, NULL);
+    state_encoder_begin_map(&enc, "AirConditionerAlias");
+    state_encoder_put_bool(&enc, "power", 1);
+    state_encoder_put_int(&enc, "currentTemperature", 25);
+    state_encoder_end_map(&enc);
+    for (int i = 0; i < sensors; ++i) {
+        snprintf(key, sizeof(key), "sensor%d", i);
+        state_encoder_begin_map(&enc, key);
+        state_encoder_put_int(&enc, "temperature", 20 + i % 10);
+        state_encoder_put_int(&enc, "humidity", 40 + i % 30);
+        state_encoder_put_int(&enc, "pressure", 1013 - i % 20);
+        state_encoder_end_map(&enc);
+    }
+    state_encoder_end_map(&enc);
+    return state_encoder_finish(&enc);
+}
+
+static double prv_cpu_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main()
+{
+    const state_encoding_t encodings[] = {
+        STATE_ENCODING_JSON,
+        STATE_ENCODING_DEFLATE,
+        STATE_ENCODING_CBOR
+    };
+    const int sensors[] = { 0, 10, 20 };
+
+    printf("| state | json | deflate | cbor |\n");
+    printf("|---|---|---|---|\n");
+    for (size_t s = 0; s < sizeof(sensors) / sizeof(sensors[0]); ++s) {
+        if (sensors[s] == 0) {
+            printf("| 1 alias (current) |");
+        } else {
+            printf("| + %d sensors |", sensors[s]);
+        }
+        for (size_t e = 0; e < sizeof(encodings) / sizeof(encodings[0]); ++e) {
+            size_t len = 0;
+            double start = prv_cpu_us();
+            for (int i = 0; i < ITERATIONS; ++i) {
+                len = prv_encode(encodings[e], sensors[s]);
+            }
+            double us = (prv_cpu_us() - start) / ITERATIONS;
+            printf(" %zu B, %.2g us |", len, us);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
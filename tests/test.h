@@ -0,0 +1,40 @@
+#ifndef __TEST
+#define __TEST
+
+/* Minimal checks for the unit tests run by "make check". Each test is a
+ * program which returns non 0 if any check failed. */
+
+#include <stdio.h>
+
+static int test_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ_INT(expected, actual) \
+    do { \
+        long long e_ = (long long)(expected); \
+        long long a_ = (long long)(actual); \
+        if (e_ != a_) { \
+            printf("%s:%d: %s: expected %lld, actual %lld\n", \
+                    __FILE__, __LINE__, #actual, e_, a_); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define TEST_RUN(test) \
+    do { \
+        int before_ = test_failures; \
+        test(); \
+        printf("%s %s\n", test_failures == before_ ? "ok  " : "FAIL", #test); \
+    } while (0)
+
+#define TEST_EXIT() (test_failures == 0 ? 0 : 1)
+
+#endif /* __TEST */
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,99 @@
+#include "test.h"
+#include "app_config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char m_path[] = "/tmp/test_app_config.XXXXXX";
+
+static void prv_defaults(app_config_t* config)
+{
+    memset(config, 0, sizeof(*config));
+    strcpy(config->app_id, "default-id");
+    strcpy(config->app_host, "api-jp.kii.com");
+    config->handler_http_buff_size = 1024;
+    config->update_period_sec = 60;
+}
+
+static int prv_load(const char* content, app_config_t* config)
+{
+    FILE* fp = fopen(m_path, "w");
+    fputs(content, fp);
+    fclose(fp);
+    prv_defaults(config);
+    return app_config_load(m_path, config);
+}
+
+static void test_overrides_keys_in_file()
+{
+    app_config_t config;
+
+    CHECK(prv_load("# sizing\n"
+                "\n"
+                "app_id = abc123\n"
+                "  handler_mqtt_buff_size=2048  \n"
+                "handler_token_num = 48\n"
+                "send_timeout_sec = 5\n"
+                "memory_budget = 67108864\n", &config) == 0);
+    CHECK(strcmp(config.app_id, "abc123") == 0);
+    CHECK_EQ_INT(2048, config.handler_mqtt_buff_size);
+    CHECK_EQ_INT(48, config.handler_token_num);
+    CHECK_EQ_INT(5, config.send_timeout_sec);
+    CHECK_EQ_INT(64 * 1024 * 1024, config.memory_budget);
+    // Keys not in the file keep the defaults.
+    CHECK(strcmp(config.app_host, "api-jp.kii.com") == 0);
+    CHECK_EQ_INT(1024, config.handler_http_buff_size);
+    CHECK_EQ_INT(60, config.update_period_sec);
+}
+
+static void test_missing_file()
+{
+    app_config_t config;
+
+    prv_defaults(&config);
+    CHECK_EQ_INT(1, app_config_load("/nonexistent/app.conf", &config));
+    CHECK(strcmp(config.app_id, "default-id") == 0);
+}
+
+static void test_invalid_files()
+{
+    app_config_t config;
+    char longId[APP_CONFIG_ID_SIZE + 16];
+
+    CHECK_EQ_INT(-1, prv_load("app_id abc\n", &config));
+    CHECK_EQ_INT(-1, prv_load("unknown_key = 1\n", &config));
+    CHECK_EQ_INT(-1, prv_load("app_id =\n", &config));
+    CHECK_EQ_INT(-1, prv_load("handler_token_num = 0\n", &config));
+    CHECK_EQ_INT(-1, prv_load("handler_token_num = -1\n", &config));
+    CHECK_EQ_INT(-1, prv_load("handler_token_num = 12k\n", &config));
+    CHECK_EQ_INT(-1, prv_load("handler_http_buff_size = 2000000\n", &config));
+    CHECK_EQ_INT(-1, prv_load("keep_alive_sec = 99999999999\n", &config));
+    CHECK_EQ_INT(-1, prv_load("memory_budget = 2147483648\n", &config));
+
+    memset(longId, 'a', sizeof(longId) - 1);
+    longId[sizeof(longId) - 1] = '\0';
+    char line[sizeof(longId) + 16];
+    snprintf(line, sizeof(line), "app_id = %s\n", longId);
+    CHECK_EQ_INT(-1, prv_load(line, &config));
+    CHECK(strcmp(config.app_id, "default-id") == 0);
+}
+
+int main()
+{
+    int fd = mkstemp(m_path);
+    if (fd < 0) {
+        printf("failed to create %s\n", m_path);
+        return 1;
+    }
+    close(fd);
+
+    TEST_RUN(test_overrides_keys_in_file);
+    TEST_RUN(test_missing_file);
+    TEST_RUN(test_invalid_files);
+
+    unlink(m_path);
+    return TEST_EXIT();
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,146 @@
+#include "test.h"
+#include "buff_region.h"
+
+#include <string.h>
+
+/* A byte buffer of 100 and a pool of 10 elements of 16 bytes, 2 each. */
+static void prv_plan(buff_region_t* region, int* bytes, int* tokens)
+{
+    buff_region_init(region);
+    *bytes = buff_region_add(region, "bytes", 1, 100, 2);
+    *tokens = buff_region_add(region, "tokens", 16, 10, 2);
+}
+
+static void test_layout_and_zero_fill()
+{
+    buff_region_t region;
+    int bytes;
+    int tokens;
+
+    prv_plan(&region, &bytes, &tokens);
+    // Buffers start on 16 byte boundaries.
+    CHECK_EQ_INT(112 * 2 + 160 * 2, buff_region_size(&region));
+    CHECK(buff_region_alloc(&region) == 0);
+    // No more kinds after allocation.
+    CHECK(buff_region_add(&region, "late", 1, 1, 1) == -1);
+
+    unsigned char* b1 = buff_region_get(&region, bytes, 1);
+    unsigned char* t0 = buff_region_get(&region, tokens, 0);
+    CHECK_EQ_INT(112, b1 - (unsigned char*)buff_region_get(&region, bytes, 0));
+    CHECK_EQ_INT(112, t0 - b1);
+    for (size_t i = 0; i < region.size; ++i) {
+        CHECK(region.mem[i] == 0x00);
+    }
+    CHECK_EQ_INT(0, buff_region_peak(&region, bytes));
+    CHECK_EQ_INT(0, buff_region_recommend(&region, bytes));
+    CHECK(!buff_region_full(&region, bytes));
+}
+
+static void test_untracked_keeps_current_size()
+{
+    buff_region_t region;
+    int bytes;
+    int tokens;
+    char* b;
+
+    prv_plan(&region, &bytes, &tokens);
+    CHECK(buff_region_alloc(&region) == 0);
+    b = buff_region_get(&region, bytes, 0);
+    memcpy(b, "12345678901234567890", 20);
+    b = buff_region_get(&region, bytes, 1);
+    memcpy(b, "1234567890123456789012345678901234567890", 40);
+    // The NUL terminator after the data is not seen.
+    b[40] = '\0';
+    CHECK_EQ_INT(40, buff_region_peak(&region, bytes));
+    CHECK(!buff_region_tracked(&region, bytes));
+    // Only a lower bound, so never less than the current size.
+    CHECK_EQ_INT(100, buff_region_recommend(&region, bytes));
+
+    // Part of the 4th element is used.
+    b = buff_region_get(&region, tokens, 1);
+    b[3 * 16 + 1] = 1;
+    CHECK_EQ_INT(4, buff_region_peak(&region, tokens));
+    CHECK_EQ_INT(10, buff_region_recommend(&region, tokens));
+    CHECK(!buff_region_full(&region, tokens));
+}
+
+static void test_tracked_peak_and_recommend()
+{
+    buff_region_t region;
+    int bytes;
+    int tokens;
+    char* b;
+    char outside[8];
+
+    prv_plan(&region, &bytes, &tokens);
+    CHECK(buff_region_alloc(&region) == 0);
+    b = buff_region_get(&region, bytes, 1);
+    // Zeros received at 50..79 are not seen by the scan.
+    buff_region_track(&region, b + 50, 30);
+    buff_region_track(&region, b, 10);
+    buff_region_track(&region, outside, sizeof(outside));
+    CHECK(buff_region_tracked(&region, bytes));
+    CHECK(!buff_region_tracked(&region, tokens));
+    CHECK_EQ_INT(80, buff_region_peak(&region, bytes));
+    // 80 + 25%, rounded up to 128 bytes.
+    CHECK_EQ_INT(128, buff_region_recommend(&region, bytes));
+    CHECK(!buff_region_full(&region, bytes));
+
+    // Data left beyond the tracked peak is still counted.
+    memset(b, 'x', 90);
+    CHECK_EQ_INT(90, buff_region_peak(&region, bytes));
+
+    // Up to the end of the buffer is full.
+    buff_region_track(&region, b + 90, 10);
+    CHECK(buff_region_full(&region, bytes));
+    CHECK_EQ_INT(100, buff_region_recommend(&region, bytes));
+}
+
+static void test_full_keeps_current_size()
+{
+    buff_region_t region;
+    int bytes;
+    int tokens;
+    char json[256];
+
+    prv_plan(&region, &bytes, &tokens);
+    CHECK(buff_region_alloc(&region) == 0);
+    memset(buff_region_get(&region, bytes, 0), 'x', 100);
+    CHECK_EQ_INT(100, buff_region_peak(&region, bytes));
+    CHECK(buff_region_full(&region, bytes));
+    // More may have been needed, so do not recommend shrinking or a guess.
+    CHECK_EQ_INT(100, buff_region_recommend(&region, bytes));
+
+    buff_region_report_json(&region, json, sizeof(json));
+    CHECK(strcmp(json,
+                "{\"bytes\":{\"peak\":100,\"recommended\":100,"
+                "\"current\":100,\"full\":true,\"tracked\":false},"
+                "\"tokens\":{\"peak\":0,\"recommended\":0,"
+                "\"current\":10,\"full\":false,\"tracked\":false}}") == 0);
+}
+
+static void test_json_truncated()
+{
+    buff_region_t region;
+    int bytes;
+    int tokens;
+    char json[16];
+
+    prv_plan(&region, &bytes, &tokens);
+    CHECK(buff_region_alloc(&region) == 0);
+    CHECK_EQ_INT(sizeof(json) - 1,
+            buff_region_report_json(&region, json, sizeof(json)));
+    CHECK_EQ_INT(sizeof(json) - 1, strlen(json));
+}
+
+int main()
+{
+    TEST_RUN(test_layout_and_zero_fill);
+    TEST_RUN(test_untracked_keeps_current_size);
+    TEST_RUN(test_tracked_peak_and_recommend);
+    TEST_RUN(test_full_keeps_current_size);
+    TEST_RUN(test_json_truncated);
+    return TEST_EXIT();
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
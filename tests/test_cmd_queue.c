@@ -0,0 +1,160 @@
+#include "test.h"
+#include "cmd_queue.h"
+
+#include <string.h>
+
+/* The worker blocks in the first command until released, so that commands
+ * pushed meanwhile stay in the queue. */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int started;
+    int released;
+    int executed;
+    cmd_queue_cmd_t last[CMD_QUEUE_CAPACITY + 1];
+} gate_t;
+
+static void prv_gate_init(gate_t* gate)
+{
+    memset(gate, 0, sizeof(*gate));
+    pthread_mutex_init(&gate->mutex, NULL);
+    pthread_cond_init(&gate->cond, NULL);
+}
+
+static void prv_exec(const cmd_queue_cmd_t* cmd, void* userdata)
+{
+    gate_t* gate = (gate_t*)userdata;
+    pthread_mutex_lock(&gate->mutex);
+    gate->started = 1;
+    pthread_cond_broadcast(&gate->cond);
+    while (!gate->released) {
+        pthread_cond_wait(&gate->cond, &gate->mutex);
+    }
+    if (gate->executed <= CMD_QUEUE_CAPACITY) {
+        gate->last[gate->executed] = *cmd;
+    }
+    gate->executed++;
+    pthread_mutex_unlock(&gate->mutex);
+}
+
+static void prv_wait_started(gate_t* gate)
+{
+    pthread_mutex_lock(&gate->mutex);
+    while (!gate->started) {
+        pthread_cond_wait(&gate->cond, &gate->mutex);
+    }
+    pthread_mutex_unlock(&gate->mutex);
+}
+
+static void prv_release(gate_t* gate)
+{
+    pthread_mutex_lock(&gate->mutex);
+    gate->released = 1;
+    pthread_cond_broadcast(&gate->cond);
+    pthread_mutex_unlock(&gate->mutex);
+}
+
+static void test_latest_value_wins()
+{
+    cmd_queue_t queue;
+    gate_t gate;
+    int device;
+    cmd_queue_stats_t stats;
+
+    prv_gate_init(&gate);
+    CHECK(cmd_queue_start(&queue, prv_exec, &gate) == 0);
+    // Taken by the worker at once, and blocks it.
+    CHECK(cmd_queue_push(&queue, &device, "AirConditionerAlias", "turnPower",
+                0, 1) == CMD_QUEUE_OK);
+    prv_wait_started(&gate);
+
+    for (int i = 0; i < 10; ++i) {
+        CHECK(cmd_queue_push(&queue, &device, "AirConditionerAlias",
+                    "turnPower", i & 1, 100 + i) == CMD_QUEUE_OK);
+    }
+    cmd_queue_get_stats(&queue, &stats);
+    CHECK_EQ_INT(1, stats.depth);
+    CHECK_EQ_INT(9, stats.coalesced);
+
+    prv_release(&gate);
+    cmd_queue_stop(&queue);
+    cmd_queue_get_stats(&queue, &stats);
+    CHECK_EQ_INT(2, stats.executed);
+    CHECK_EQ_INT(2, gate.executed);
+    // The latest value and trace replace the pending command.
+    CHECK_EQ_INT(1, gate.last[1].bool_value);
+    CHECK_EQ_INT(109, gate.last[1].trace_id);
+}
+
+static void test_different_keys_are_not_coalesced()
+{
+    cmd_queue_t queue;
+    gate_t gate;
+    int device1;
+    int device2;
+    cmd_queue_stats_t stats;
+
+    prv_gate_init(&gate);
+    CHECK(cmd_queue_start(&queue, prv_exec, &gate) == 0);
+    CHECK(cmd_queue_push(&queue, &device1, "a", "x", 0, 0) == CMD_QUEUE_OK);
+    prv_wait_started(&gate);
+
+    CHECK(cmd_queue_push(&queue, &device1, "a", "x", 1, 0) == CMD_QUEUE_OK);
+    CHECK(cmd_queue_push(&queue, &device2, "a", "x", 1, 0) == CMD_QUEUE_OK);
+    CHECK(cmd_queue_push(&queue, &device1, "b", "x", 1, 0) == CMD_QUEUE_OK);
+    CHECK(cmd_queue_push(&queue, &device1, "a", "y", 1, 0) == CMD_QUEUE_OK);
+    cmd_queue_get_stats(&queue, &stats);
+    CHECK_EQ_INT(4, stats.depth);
+    CHECK_EQ_INT(0, stats.coalesced);
+
+    prv_release(&gate);
+    cmd_queue_stop(&queue);
+    CHECK_EQ_INT(5, gate.executed);
+    // In order of arrival.
+    CHECK(gate.last[2].target == &device2);
+    CHECK(strcmp(gate.last[3].alias, "b") == 0);
+    CHECK(strcmp(gate.last[4].action_name, "y") == 0);
+}
+
+static void test_full_and_stopped()
+{
+    cmd_queue_t queue;
+    gate_t gate;
+    int device;
+    char name[16];
+    cmd_queue_stats_t stats;
+
+    prv_gate_init(&gate);
+    CHECK(cmd_queue_start(&queue, prv_exec, &gate) == 0);
+    CHECK(cmd_queue_push(&queue, &device, "a", "first", 0, 0) == CMD_QUEUE_OK);
+    prv_wait_started(&gate);
+
+    for (int i = 0; i < CMD_QUEUE_CAPACITY; ++i) {
+        snprintf(name, sizeof(name), "action%d", i);
+        CHECK(cmd_queue_push(&queue, &device, "a", name, 0, 0) == CMD_QUEUE_OK);
+    }
+    CHECK(cmd_queue_push(&queue, &device, "a", "overflow", 0, 0)
+            == CMD_QUEUE_FULL);
+    // A full queue still takes a newer value of a pending command.
+    CHECK(cmd_queue_push(&queue, &device, "a", "action0", 1, 0)
+            == CMD_QUEUE_OK);
+    cmd_queue_get_stats(&queue, &stats);
+    CHECK_EQ_INT(1, stats.rejected);
+    CHECK_EQ_INT(CMD_QUEUE_CAPACITY, stats.max_depth);
+
+    prv_release(&gate);
+    cmd_queue_stop(&queue);
+    CHECK_EQ_INT(CMD_QUEUE_CAPACITY + 1, gate.executed);
+    CHECK(cmd_queue_push(&queue, &device, "a", "late", 0, 0)
+            == CMD_QUEUE_STOPPED);
+}
+
+int main()
+{
+    TEST_RUN(test_latest_value_wins);
+    TEST_RUN(test_different_keys_are_not_coalesced);
+    TEST_RUN(test_full_and_stopped);
+    return TEST_EXIT();
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,138 @@
+#include "test.h"
+#include "cred_store.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define APP_ID "app1"
+#define APP_HOST "api-jp.kii.com"
+
+static char m_dir[] = "/tmp/test_cred_store.XXXXXX";
+static char m_path[256];
+
+static kii_author_t prv_author()
+{
+    kii_author_t author;
+    memset(&author, 0, sizeof(author));
+    strcpy(author.author_id, "th.1234567890");
+    strcpy(author.access_token, "token-abc");
+    return author;
+}
+
+static void prv_write_file(const char* content)
+{
+    FILE* fp = fopen(m_path, "w");
+    fputs(content, fp);
+    fclose(fp);
+}
+
+static void test_round_trip()
+{
+    kii_author_t author = prv_author();
+    kii_author_t loaded;
+    struct stat st;
+
+    CHECK(cred_store_save(m_path, APP_ID, APP_HOST, "vt-1", &author) == 0);
+    CHECK(stat(m_path, &st) == 0);
+    CHECK_EQ_INT(0600, st.st_mode & 0777);
+
+    memset(&loaded, 0, sizeof(loaded));
+    CHECK(cred_store_load(m_path, APP_ID, APP_HOST, "vt-1", &loaded) == 0);
+    CHECK(strcmp(loaded.author_id, author.author_id) == 0);
+    CHECK(strcmp(loaded.access_token, author.access_token) == 0);
+
+    // Saving again replaces the file.
+    strcpy(author.access_token, "token-new");
+    CHECK(cred_store_save(m_path, APP_ID, APP_HOST, "vt-1", &author) == 0);
+    CHECK(cred_store_load(m_path, APP_ID, APP_HOST, "vt-1", &loaded) == 0);
+    CHECK(strcmp(loaded.access_token, "token-new") == 0);
+}
+
+static void test_other_thing_or_app_is_not_loaded()
+{
+    kii_author_t author = prv_author();
+    kii_author_t loaded;
+
+    CHECK(cred_store_save(m_path, APP_ID, APP_HOST, "vt-1", &author) == 0);
+    CHECK(cred_store_load(m_path, APP_ID, APP_HOST, "vt-2", &loaded) != 0);
+    CHECK(cred_store_load(m_path, "app2", APP_HOST, "vt-1", &loaded) != 0);
+    CHECK(cred_store_load(m_path, APP_ID, "api.kii.com", "vt-1", &loaded)
+            != 0);
+}
+
+static void test_corrupted_file_is_not_loaded()
+{
+    kii_author_t loaded;
+    const char* files[] = {
+        // Truncated in the middle of the token.
+        "thing-if-credentials 2\napp1\napi-jp.kii.com\nvt-1\nth.1\ntok",
+        // Token missing.
+        "thing-if-credentials 2\napp1\napi-jp.kii.com\nvt-1\nth.1\n",
+        // Empty token.
+        "thing-if-credentials 2\napp1\napi-jp.kii.com\nvt-1\nth.1\n\n",
+        // Version 1 has no app id and host.
+        "thing-if-credentials 1\nvt-1\nth.1\ntoken\n",
+        "garbage\n",
+        ""
+    };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+        prv_write_file(files[i]);
+        if (cred_store_load(m_path, APP_ID, APP_HOST, "vt-1", &loaded) == 0) {
+            printf("loaded: %zu\n", i);
+            test_failures++;
+        }
+    }
+
+    prv_write_file("thing-if-credentials 2\napp1\napi-jp.kii.com\nvt-1\nth.1\n"
+            "token\n");
+    CHECK(cred_store_load(m_path, APP_ID, APP_HOST, "vt-1", &loaded) == 0);
+}
+
+static void test_remove()
+{
+    kii_author_t author = prv_author();
+    kii_author_t loaded;
+
+    CHECK(cred_store_save(m_path, APP_ID, APP_HOST, "vt-1", &author) == 0);
+    CHECK(cred_store_remove(m_path) == 0);
+    CHECK(cred_store_load(m_path, APP_ID, APP_HOST, "vt-1", &loaded) != 0);
+    // Removing a missing file is not an error.
+    CHECK(cred_store_remove(m_path) == 0);
+}
+
+static void test_directory_is_created()
+{
+    kii_author_t author = prv_author();
+    char path[300];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s/sub/credentials", m_dir);
+    CHECK(cred_store_save(path, APP_ID, APP_HOST, "vt-1", &author) == 0);
+    snprintf(path, sizeof(path), "%s/sub", m_dir);
+    CHECK(stat(path, &st) == 0);
+    CHECK_EQ_INT(0700, st.st_mode & 0777);
+}
+
+int main()
+{
+    if (mkdtemp(m_dir) == NULL) {
+        printf("failed to create %s\n", m_dir);
+        return 1;
+    }
+    snprintf(m_path, sizeof(m_path), "%s/credentials", m_dir);
+
+    TEST_RUN(test_round_trip);
+    TEST_RUN(test_other_thing_or_app_is_not_loaded);
+    TEST_RUN(test_corrupted_file_is_not_loaded);
+    TEST_RUN(test_remove);
+    TEST_RUN(test_directory_is_created);
+
+    char command[300];
+    snprintf(command, sizeof(command), "rm -rf %s", m_dir);
+    system(command);
+    return TEST_EXIT();
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
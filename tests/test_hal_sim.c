@@ -0,0 +1,79 @@
+#include "test.h"
+#include "hal.h"
+#include "pi_control.h"
+
+#include <string.h>
+
+static void prv_configure(const char* curve, double crc_fault_rate,
+        double missing_fault_rate, unsigned int probe_num)
+{
+    hal_sim_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.temperature_curve = curve;
+    config.crc_fault_rate = crc_fault_rate;
+    config.missing_fault_rate = missing_fault_rate;
+    config.probe_num = probe_num;
+    CHECK(hal_sim_configure(&config) == 0);
+    CHECK(hal_sim_backend.init() == 0);
+}
+
+static void test_parse_w1_slave()
+{
+    CHECK_EQ_INT(23125, parseDS18B20(
+                "72 01 4b 46 7f ff 0e 10 57 : crc=57 YES\n"
+                "72 01 4b 46 7f ff 0e 10 57 t=23125\n"));
+    CHECK_EQ_INT(-10062, parseDS18B20(
+                "5f ff 4b 46 7f ff 0c 10 1c : crc=1c YES\n"
+                "5f ff 4b 46 7f ff 0c 10 1c t=-10062\n"));
+    CHECK_EQ_INT(HAL_TEMP_ERR_CRC, parseDS18B20(
+                "72 01 4b 46 7f ff 0e 10 57 : crc=00 NO\n"
+                "72 01 4b 46 7f ff 0e 10 57 t=23125\n"));
+    CHECK_EQ_INT(HAL_TEMP_ERR_FORMAT, parseDS18B20(
+                "72 01 4b 46 7f ff 0e 10 57 : crc=57 YES\n"));
+}
+
+static void test_temperature_in_sensor_steps()
+{
+    prv_configure("0:23.5", 0, 0, 0);
+    CHECK_EQ_INT(23500, hal_sim_backend.read_temperature());
+    // 1/16 degree steps, truncated as the kernel does.
+    prv_configure("0:-10.06", 0, 0, 0);
+    CHECK_EQ_INT(-10062, hal_sim_backend.read_temperature());
+    prv_configure("0:25.01", 0, 0, 0);
+    CHECK_EQ_INT(25000, hal_sim_backend.read_temperature());
+}
+
+static void test_faults()
+{
+    prv_configure("0:20", 1.0, 0, 0);
+    CHECK_EQ_INT(HAL_TEMP_ERR_CRC, hal_sim_backend.read_temperature());
+    prv_configure("0:20", 0, 1.0, 0);
+    CHECK_EQ_INT(HAL_TEMP_ERR_NO_DEVICE, hal_sim_backend.read_temperature());
+}
+
+static void test_probes()
+{
+    char ids[4][HAL_PROBE_ID_SIZE];
+
+    prv_configure("0:20,10:30", 0, 0, 2);
+    CHECK_EQ_INT(2, hal_sim_backend.list_probes(&ids[0][0], 4));
+    CHECK(strcmp(ids[1], "sim-1") == 0);
+    CHECK_EQ_INT(1, hal_sim_backend.list_probes(&ids[0][0], 1));
+    // Shifted by half the period.
+    CHECK_EQ_INT(25000, hal_sim_backend.read_probe_temperature("sim-1"));
+    CHECK_EQ_INT(HAL_TEMP_ERR_NO_DEVICE,
+            hal_sim_backend.read_probe_temperature("sim-2"));
+    CHECK_EQ_INT(HAL_TEMP_ERR_NO_DEVICE,
+            hal_sim_backend.read_probe_temperature("28-0416925607ff"));
+}
+
+int main()
+{
+    TEST_RUN(test_parse_w1_slave);
+    TEST_RUN(test_temperature_in_sensor_steps);
+    TEST_RUN(test_faults);
+    TEST_RUN(test_probes);
+    return TEST_EXIT();
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
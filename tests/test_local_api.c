@@ -0,0 +1,201 @@
+#include "test.h"
+#include "local_api.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static char m_dir[] = "/tmp/test_local_api.XXXXXX";
+static char m_path[128];
+static local_api_t m_api;
+
+/* "big" is answered with a full response, others are echoed. */
+static size_t prv_request_cb(
+        const char* request,
+        char* response,
+        size_t response_size,
+        void* userdata)
+{
+    if (strcmp(request, "big") == 0) {
+        memset(response, 'b', response_size);
+        return response_size;
+    }
+    return snprintf(response, response_size, "ok:%s", request);
+}
+
+static int prv_connect()
+{
+    struct sockaddr_un addr;
+    struct timeval timeout = { 2, 0 };
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, m_path);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+static void prv_send(int fd, const char* data)
+{
+    CHECK_EQ_INT(strlen(data), send(fd, data, strlen(data), MSG_NOSIGNAL));
+}
+
+/* Read a line without the newline. Returns -1 on close or timeout. */
+static int prv_read_line(int fd, char* line, size_t size)
+{
+    size_t len = 0;
+    while (len < size - 1) {
+        char c;
+        if (recv(fd, &c, 1, 0) != 1) {
+            return -1;
+        }
+        if (c == '\n') {
+            break;
+        }
+        line[len++] = c;
+    }
+    line[len] = '\0';
+    return (int)len;
+}
+
+static void prv_check_response(int fd, const char* expected)
+{
+    char line[LOCAL_API_RESPONSE_SIZE + 1];
+    CHECK(prv_read_line(fd, line, sizeof(line)) >= 0);
+    CHECK(strcmp(line, expected) == 0);
+}
+
+static void test_socket_mode()
+{
+    struct stat st;
+    CHECK(stat(m_path, &st) == 0);
+    CHECK_EQ_INT(0660, st.st_mode & 0777);
+}
+
+static void test_partial_and_pipelined_lines()
+{
+    int fd = prv_connect();
+    CHECK(fd >= 0);
+
+    prv_send(fd, "sta");
+    usleep(50 * 1000);
+    prv_send(fd, "te\r\n");
+    prv_check_response(fd, "ok:state");
+
+    prv_send(fd, "a\nb\nc\n");
+    prv_check_response(fd, "ok:a");
+    prv_check_response(fd, "ok:b");
+    prv_check_response(fd, "ok:c");
+    close(fd);
+}
+
+static void test_too_long_line()
+{
+    char line[LOCAL_API_LINE_SIZE * 2 + 1];
+    int fd = prv_connect();
+    CHECK(fd >= 0);
+
+    memset(line, 'x', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+    prv_send(fd, line);
+    prv_send(fd, "tail\nnext\n");
+    prv_check_response(fd, "{\"error\":\"request too long\"}");
+    // The tail of the long line is not a request.
+    prv_check_response(fd, "ok:next");
+    close(fd);
+}
+
+static void test_client_limit()
+{
+    int fds[LOCAL_API_MAX_CLIENTS];
+    char line[64];
+
+    for (int i = 0; i < LOCAL_API_MAX_CLIENTS; ++i) {
+        fds[i] = prv_connect();
+        CHECK(fds[i] >= 0);
+        prv_send(fds[i], "hello\n");
+        prv_check_response(fds[i], "ok:hello");
+    }
+    // Closed by the server.
+    int extra = prv_connect();
+    CHECK(extra >= 0);
+    send(extra, "hello\n", 6, MSG_NOSIGNAL);
+    CHECK(prv_read_line(extra, line, sizeof(line)) < 0);
+    close(extra);
+
+    // A slot is given to the next client.
+    close(fds[0]);
+    usleep(50 * 1000);
+    fds[0] = prv_connect();
+    CHECK(fds[0] >= 0);
+    prv_send(fds[0], "again\n");
+    prv_check_response(fds[0], "ok:again");
+
+    for (int i = 0; i < LOCAL_API_MAX_CLIENTS; ++i) {
+        close(fds[i]);
+    }
+}
+
+static void test_disconnect_mid_response()
+{
+    char requests[64 * 4 + 1];
+    char line[LOCAL_API_RESPONSE_SIZE + 1];
+    int fd = prv_connect();
+    CHECK(fd >= 0);
+
+    // More responses than the socket buffers, never read.
+    requests[0] = '\0';
+    for (int i = 0; i < 64; ++i) {
+        strcat(requests, "big\n");
+    }
+    int rcvbuf = 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    prv_send(fd, requests);
+    usleep(50 * 1000);
+    close(fd);
+
+    // Others are still served.
+    fd = prv_connect();
+    CHECK(fd >= 0);
+    prv_send(fd, "big\n");
+    CHECK_EQ_INT(LOCAL_API_RESPONSE_SIZE - 1,
+            prv_read_line(fd, line, sizeof(line)));
+    prv_send(fd, "after\n");
+    prv_check_response(fd, "ok:after");
+    close(fd);
+}
+
+int main()
+{
+    if (mkdtemp(m_dir) == NULL) {
+        printf("failed to create %s\n", m_dir);
+        return 1;
+    }
+    snprintf(m_path, sizeof(m_path), "%s/api.sock", m_dir);
+    if (local_api_start(&m_api, m_path, 0, prv_request_cb, NULL) != 0) {
+        printf("failed to start local API\n");
+        return 1;
+    }
+
+    TEST_RUN(test_socket_mode);
+    TEST_RUN(test_partial_and_pipelined_lines);
+    TEST_RUN(test_too_long_line);
+    TEST_RUN(test_client_limit);
+    TEST_RUN(test_disconnect_mid_response);
+
+    local_api_stop(&m_api);
+    unlink(m_path);
+    rmdir(m_dir);
+    return TEST_EXIT();
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
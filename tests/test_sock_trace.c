@@ -0,0 +1,264 @@
+#include "test.h"
+#include "sock_trace.h"
+#include "sys_cb_impl.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char m_path[] = "/tmp/test_sock_trace.XXXXXX";
+
+static void prv_record(int stream, sock_trace_type_t type, const char* data)
+{
+    sock_trace_record(stream, type, data, data != NULL ? strlen(data) : 0);
+}
+
+static khc_sock_code_t prv_send(socket_context_t* ctx, const char* data)
+{
+    size_t sent = 0;
+    khc_sock_code_t ret = sock_replay_send(ctx, data, strlen(data), &sent);
+    return sent == strlen(data) ? ret : KHC_SOCK_FAIL;
+}
+
+/* Receive into a NUL terminated buffer. */
+static khc_sock_code_t prv_recv(socket_context_t* ctx, char* buffer,
+        size_t size)
+{
+    size_t received = 0;
+    khc_sock_code_t ret = sock_replay_recv(ctx, buffer, size - 1, &received);
+    buffer[received] = '\0';
+    return ret;
+}
+
+/* MQTT on stream 2 and one HTTP request on stream 0. */
+static void prv_record_session()
+{
+    CHECK(sock_trace_record_open(m_path) == 0);
+    CHECK(sock_trace_mode() == SOCK_TRACE_RECORDING);
+    prv_record(2, SOCK_TRACE_CONNECT, "mqtt.example.com:8883");
+    prv_record(0, SOCK_TRACE_CONNECT, "api.example.com:443");
+    prv_record(2, SOCK_TRACE_SEND, "CONNECT");
+    prv_record(0, SOCK_TRACE_SEND, "GET /a");
+    prv_record(2, SOCK_TRACE_RECV, "CONNACK");
+    prv_record(0, SOCK_TRACE_RECV, "HTTP/1.1 200 OK");
+    prv_record(0, SOCK_TRACE_RECV, NULL);
+    prv_record(0, SOCK_TRACE_CLOSE, NULL);
+    // Idle until the keep-alive.
+    prv_record(2, SOCK_TRACE_RECV_AGAIN, NULL);
+    prv_record(2, SOCK_TRACE_SEND, "PINGREQ");
+    prv_record(2, SOCK_TRACE_RECV, "PINGRESP");
+    prv_record(2, SOCK_TRACE_RECV_FAIL, NULL);
+    sock_trace_close();
+    CHECK(sock_trace_mode() == SOCK_TRACE_OFF);
+}
+
+static void test_replay_in_order()
+{
+    socket_context_t http;
+    socket_context_t mqtt;
+    char buffer[64];
+    sock_trace_stats_t stats;
+
+    memset(&http, 0, sizeof(http));
+    memset(&mqtt, 0, sizeof(mqtt));
+    http.trace_stream = 0;
+    mqtt.trace_stream = 2;
+    prv_record_session();
+    CHECK(sock_trace_replay_open(m_path, 0) == 0);
+    CHECK(sock_trace_replay_fast());
+
+    CHECK(sock_replay_connect(&mqtt, "mqtt.example.com", 8883)
+            == KHC_SOCK_OK);
+    // Nothing to receive before the request is sent.
+    CHECK(prv_recv(&mqtt, buffer, sizeof(buffer)) == KHC_SOCK_AGAIN);
+    CHECK(prv_send(&mqtt, "CONNECT") == KHC_SOCK_OK);
+    // Served in chunks of the requested size.
+    CHECK(prv_recv(&mqtt, buffer, 4) == KHC_SOCK_OK);
+    CHECK(strcmp(buffer, "CON") == 0);
+    CHECK(prv_recv(&mqtt, buffer, sizeof(buffer)) == KHC_SOCK_OK);
+    CHECK(strcmp(buffer, "NACK") == 0);
+
+    CHECK(sock_replay_connect(&http, "api.example.com", 443) == KHC_SOCK_OK);
+    CHECK(prv_send(&http, "GET /b") == KHC_SOCK_OK);
+    CHECK(prv_recv(&http, buffer, sizeof(buffer)) == KHC_SOCK_OK);
+    CHECK(strcmp(buffer, "HTTP/1.1 200 OK") == 0);
+    // Closed by the server, as recorded.
+    CHECK(prv_recv(&http, buffer, sizeof(buffer)) == KHC_SOCK_OK);
+    CHECK(buffer[0] == '\0');
+    CHECK(sock_replay_close(&http) == KHC_SOCK_OK);
+
+    // The recorded timeout, then the keep-alive is not swallowed by an
+    // idle receive.
+    CHECK(prv_recv(&mqtt, buffer, sizeof(buffer)) == KHC_SOCK_AGAIN);
+    CHECK(prv_recv(&mqtt, buffer, sizeof(buffer)) == KHC_SOCK_AGAIN);
+    CHECK(prv_send(&mqtt, "PINGREQ") == KHC_SOCK_OK);
+    CHECK(prv_recv(&mqtt, buffer, sizeof(buffer)) == KHC_SOCK_OK);
+    CHECK(strcmp(buffer, "PINGRESP") == 0);
+    CHECK(prv_recv(&mqtt, buffer, sizeof(buffer)) == KHC_SOCK_FAIL);
+    CHECK(!sock_trace_replay_done());
+
+    // Nothing left in either stream.
+    CHECK(prv_recv(&mqtt, buffer, sizeof(buffer)) == KHC_SOCK_OK);
+    CHECK(sock_replay_connect(&http, "api.example.com", 443)
+            == KHC_SOCK_FAIL);
+    CHECK(sock_trace_replay_done());
+
+    sock_trace_get_stats(&stats);
+    CHECK_EQ_INT(2, stats.connects);
+    CHECK_EQ_INT(2, stats.recv_blocked);
+    // "GET /a" and "GET /b"
+    CHECK_EQ_INT(1, stats.send_mismatches);
+    CHECK_EQ_INT(0, stats.send_unexpected);
+    CHECK_EQ_INT(0, stats.send_missing);
+    sock_trace_close();
+}
+
+static void test_unexpected_and_missing_sends()
+{
+    socket_context_t ctx;
+    char buffer[64];
+    sock_trace_stats_t stats;
+
+    memset(&ctx, 0, sizeof(ctx));
+    CHECK(sock_trace_record_open(m_path) == 0);
+    prv_record(0, SOCK_TRACE_CONNECT, "a:1");
+    prv_record(0, SOCK_TRACE_SEND, "abc");
+    prv_record(0, SOCK_TRACE_RECV, "x");
+    prv_record(0, SOCK_TRACE_CONNECT, "a:1");
+    prv_record(0, SOCK_TRACE_SEND, "d");
+    sock_trace_close();
+
+    CHECK(sock_trace_replay_open(m_path, 1) == 0);
+    CHECK(!sock_trace_replay_fast());
+    CHECK(sock_replay_connect(&ctx, "a", 1) == KHC_SOCK_OK);
+    // Reconnect before sending: the first request is missing.
+    CHECK(sock_replay_connect(&ctx, "a", 1) == KHC_SOCK_OK);
+    CHECK(prv_send(&ctx, "dxy") == KHC_SOCK_OK);
+    CHECK(prv_recv(&ctx, buffer, sizeof(buffer)) == KHC_SOCK_OK);
+
+    sock_trace_get_stats(&stats);
+    CHECK_EQ_INT(3, stats.send_missing);
+    CHECK_EQ_INT(2, stats.send_unexpected);
+    CHECK_EQ_INT(0, stats.send_mismatches);
+    sock_trace_close();
+}
+
+static void test_truncated_and_unsupported_files()
+{
+    socket_context_t ctx;
+    char buffer[64];
+
+    memset(&ctx, 0, sizeof(ctx));
+    CHECK(sock_trace_record_open(m_path) == 0);
+    prv_record(0, SOCK_TRACE_CONNECT, "a:1");
+    prv_record(0, SOCK_TRACE_RECV, "complete");
+    prv_record(0, SOCK_TRACE_RECV, "cut by a crash");
+    sock_trace_close();
+    // Drop the end of the last record.
+    FILE* fp = fopen(m_path, "rb+");
+    fseek(fp, 0, SEEK_END);
+    CHECK(ftruncate(fileno(fp), ftell(fp) - 3) == 0);
+    fclose(fp);
+
+    CHECK(sock_trace_replay_open(m_path, 0) == 0);
+    CHECK(sock_replay_connect(&ctx, "a", 1) == KHC_SOCK_OK);
+    CHECK(prv_recv(&ctx, buffer, sizeof(buffer)) == KHC_SOCK_OK);
+    CHECK(strcmp(buffer, "complete") == 0);
+    CHECK(prv_recv(&ctx, buffer, sizeof(buffer)) == KHC_SOCK_OK);
+    CHECK(buffer[0] == '\0');
+    CHECK(sock_trace_replay_done());
+    sock_trace_close();
+
+    // Version 1 has no receive timeout records.
+    uint32_t version = 1;
+    fp = fopen(m_path, "wb");
+    fwrite("SKTR", 4, 1, fp);
+    fwrite(&version, sizeof(version), 1, fp);
+    fclose(fp);
+    CHECK(sock_trace_replay_open(m_path, 0) != 0);
+    CHECK(sock_trace_mode() == SOCK_TRACE_OFF);
+}
+
+typedef struct {
+    socket_context_t ctx;
+    int calls;
+    char buffer[64];
+} prv_receiver_t;
+
+static void* prv_receive(void* arg)
+{
+    prv_receiver_t* receiver = (prv_receiver_t*)arg;
+    while (prv_recv(&receiver->ctx, receiver->buffer,
+                sizeof(receiver->buffer)) == KHC_SOCK_AGAIN) {
+        receiver->calls++;
+    }
+    return NULL;
+}
+
+static void test_fast_replay_blocks_until_sent()
+{
+    prv_receiver_t receiver;
+    pthread_t thread;
+
+    CHECK(sock_trace_record_open(m_path) == 0);
+    prv_record(0, SOCK_TRACE_CONNECT, "a:1");
+    prv_record(0, SOCK_TRACE_SEND, "REQ");
+    prv_record(0, SOCK_TRACE_RECV, "RESP");
+    sock_trace_close();
+
+    memset(&receiver, 0, sizeof(receiver));
+    CHECK(sock_trace_replay_open(m_path, 0) == 0);
+    CHECK(sock_replay_connect(&receiver.ctx, "a", 1) == KHC_SOCK_OK);
+    CHECK(pthread_create(&thread, NULL, prv_receive, &receiver) == 0);
+    usleep(100 * 1000);
+    CHECK(prv_send(&receiver.ctx, "REQ") == KHC_SOCK_OK);
+    pthread_join(thread, NULL);
+    CHECK(strcmp(receiver.buffer, "RESP") == 0);
+    // About one receive per SOCK_TRACE_FAST_BLOCK_MS, not a busy loop.
+    CHECK(receiver.calls > 0);
+    CHECK(receiver.calls <= 2 * 100 / SOCK_TRACE_FAST_BLOCK_MS);
+    sock_trace_close();
+}
+
+static void test_record_file_is_private()
+{
+    char link_path[sizeof(m_path) + 8];
+    struct stat st;
+
+    // Open to others before recording.
+    CHECK(chmod(m_path, 0644) == 0);
+    CHECK(sock_trace_record_open(m_path) == 0);
+    sock_trace_close();
+    CHECK(stat(m_path, &st) == 0);
+    CHECK_EQ_INT(0600, st.st_mode & 0777);
+
+    snprintf(link_path, sizeof(link_path), "%s.link", m_path);
+    CHECK(symlink(m_path, link_path) == 0);
+    CHECK(sock_trace_record_open(link_path) != 0);
+    CHECK(sock_trace_mode() == SOCK_TRACE_OFF);
+    unlink(link_path);
+}
+
+int main()
+{
+    int fd = mkstemp(m_path);
+    if (fd < 0) {
+        printf("failed to create %s\n", m_path);
+        return 1;
+    }
+    close(fd);
+
+    TEST_RUN(test_replay_in_order);
+    TEST_RUN(test_unexpected_and_missing_sends);
+    TEST_RUN(test_truncated_and_unsupported_files);
+    TEST_RUN(test_fast_replay_blocks_until_sent);
+    TEST_RUN(test_record_file_is_private);
+
+    unlink(m_path);
+    return TEST_EXIT();
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
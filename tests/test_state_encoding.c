@@ -0,0 +1,124 @@
+#include "test.h"
+#include "state_encoding.h"
+
+#include <string.h>
+#include <zlib.h>
+
+#define STATE_JSON \
+    "{\"AirConditionerAlias\":{\"power\":true,\"currentTemperature\":25}}"
+
+static char m_out[1024];
+static char m_work[1024 + STATE_ENCODING_ZLIB_MEM_SIZE];
+
+/* State uploaded by the updater. */
+static size_t prv_encode(state_encoding_t encoding, size_t out_size,
+        long temperature)
+{
+    state_encoder_t enc;
+    state_encoder_init(&enc, encoding, m_out, out_size, m_work,
+            sizeof(m_work));
+    state_encoder_begin_map(&enc, NULL);
+    state_encoder_begin_map(&enc, "AirConditionerAlias");
+    state_encoder_put_bool(&enc, "power", 1);
+    state_encoder_put_int(&enc, "currentTemperature", temperature);
+    state_encoder_end_map(&enc);
+    state_encoder_end_map(&enc);
+    return state_encoder_finish(&enc);
+}
+
+static void test_json()
+{
+    size_t len = prv_encode(STATE_ENCODING_JSON, sizeof(m_out), 25);
+    CHECK_EQ_INT(strlen(STATE_JSON), len);
+    CHECK(memcmp(m_out, STATE_JSON, len) == 0);
+
+    len = prv_encode(STATE_ENCODING_JSON, sizeof(m_out), -5);
+    CHECK(memcmp(m_out, "{\"AirConditionerAlias\":{\"power\":true,"
+                "\"currentTemperature\":-5}}", len) == 0);
+}
+
+static void test_cbor()
+{
+    const unsigned char expected[] = {
+        0xbf,
+        0x73, 'A', 'i', 'r', 'C', 'o', 'n', 'd', 'i', 't', 'i', 'o', 'n',
+        'e', 'r', 'A', 'l', 'i', 'a', 's',
+        0xbf,
+        0x65, 'p', 'o', 'w', 'e', 'r', 0xf5,
+        0x72, 'c', 'u', 'r', 'r', 'e', 'n', 't', 'T', 'e', 'm', 'p', 'e',
+        'r', 'a', 't', 'u', 'r', 'e', 0x18, 25,
+        0xff,
+        0xff
+    };
+    size_t len = prv_encode(STATE_ENCODING_CBOR, sizeof(m_out), 25);
+    CHECK_EQ_INT(sizeof(expected), len);
+    CHECK(memcmp(m_out, expected, sizeof(expected)) == 0);
+
+    // Negative integer: -1 - 4
+    len = prv_encode(STATE_ENCODING_CBOR, sizeof(m_out), -5);
+    CHECK_EQ_INT(0x24, (unsigned char)m_out[len - 3]);
+}
+
+static void test_deflate_inflates_to_json()
+{
+    char inflated[256];
+    uLongf inflated_len = sizeof(inflated);
+
+    size_t len = prv_encode(STATE_ENCODING_DEFLATE, sizeof(m_out), 25);
+    CHECK(len > 0);
+    CHECK(uncompress((Bytef*)inflated, &inflated_len, (Bytef*)m_out, len)
+            == Z_OK);
+    CHECK_EQ_INT(strlen(STATE_JSON), inflated_len);
+    CHECK(memcmp(inflated, STATE_JSON, inflated_len) == 0);
+}
+
+static void test_too_small()
+{
+    CHECK_EQ_INT(0, prv_encode(STATE_ENCODING_JSON, 10, 25));
+    CHECK_EQ_INT(0, prv_encode(STATE_ENCODING_CBOR, 10, 25));
+    CHECK_EQ_INT(0, prv_encode(STATE_ENCODING_DEFLATE, 10, 25));
+
+    // No room for the JSON after the memory of zlib.
+    state_encoder_t enc;
+    state_encoder_init(&enc, STATE_ENCODING_DEFLATE, m_out, sizeof(m_out),
+            m_work, STATE_ENCODING_ZLIB_MEM_SIZE);
+    state_encoder_begin_map(&enc, NULL);
+    state_encoder_end_map(&enc);
+    CHECK_EQ_INT(0, state_encoder_finish(&enc));
+}
+
+static void test_unbalanced_maps()
+{
+    state_encoder_t enc;
+    state_encoder_init(&enc, STATE_ENCODING_JSON, m_out, sizeof(m_out),
+            NULL, 0);
+    state_encoder_begin_map(&enc, NULL);
+    CHECK_EQ_INT(0, state_encoder_finish(&enc));
+
+    state_encoder_init(&enc, STATE_ENCODING_JSON, m_out, sizeof(m_out),
+            NULL, 0);
+    state_encoder_end_map(&enc);
+    CHECK_EQ_INT(0, state_encoder_finish(&enc));
+}
+
+static void test_parse()
+{
+    state_encoding_t encoding;
+    CHECK(state_encoding_parse("cbor", &encoding) == 0);
+    CHECK(encoding == STATE_ENCODING_CBOR);
+    CHECK(strcmp(state_encoding_name(encoding), "cbor") == 0);
+    CHECK(state_encoding_parse("gzip", &encoding) != 0);
+}
+
+int main()
+{
+    TEST_RUN(test_json);
+    TEST_RUN(test_cbor);
+    TEST_RUN(test_deflate_inflates_to_json);
+    TEST_RUN(test_too_small);
+    TEST_RUN(test_unbalanced_maps);
+    TEST_RUN(test_parse);
+    return TEST_EXIT();
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,132 @@
+#include "test.h"
+#include "state_store.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define WRITES 200000
+
+typedef struct {
+    int calls;
+    unsigned int changed;
+    device_state_t state;
+} prv_change_t;
+
+static void prv_on_change(
+        const device_state_t* state,
+        unsigned int changed,
+        void* userdata)
+{
+    prv_change_t* change = (prv_change_t*)userdata;
+    change->calls++;
+    change->changed = changed;
+    change->state = *state;
+}
+
+static void test_version_and_subscribers()
+{
+    state_store_t store;
+    prv_change_t power;
+    prv_change_t any;
+    device_state_t state;
+
+    memset(&power, 0, sizeof(power));
+    memset(&any, 0, sizeof(any));
+    state_store_init(&store);
+    CHECK(state_store_subscribe(&store, STATE_FIELD_POWER, prv_on_change,
+                &power) == 0);
+    CHECK(state_store_subscribe(&store,
+                STATE_FIELD_POWER | STATE_FIELD_TEMPERATURE, prv_on_change,
+                &any) == 0);
+
+    state_store_read(&store, &state);
+    CHECK_EQ_INT(0, state.version);
+
+    state_store_set_temperature(&store, 25);
+    CHECK_EQ_INT(0, power.calls);
+    CHECK_EQ_INT(1, any.calls);
+    CHECK_EQ_INT(STATE_FIELD_TEMPERATURE, any.changed);
+    CHECK_EQ_INT(25, any.state.temperature);
+
+    CHECK_EQ_INT(1, state_store_set_power(&store, 1));
+    CHECK_EQ_INT(1, power.calls);
+    CHECK_EQ_INT(1, power.state.power);
+    CHECK_EQ_INT(25, power.state.temperature);
+    CHECK_EQ_INT(2, power.state.version);
+
+    // Same value is not a change.
+    CHECK_EQ_INT(0, state_store_set_power(&store, 1));
+    CHECK_EQ_INT(1, power.calls);
+    state_store_read(&store, &state);
+    CHECK_EQ_INT(2, state.version);
+    CHECK_EQ_INT(1, state.power);
+    CHECK_EQ_INT(25, state.temperature);
+}
+
+static void test_subscribers_are_limited()
+{
+    state_store_t store;
+    prv_change_t change;
+
+    state_store_init(&store);
+    for (int i = 0; i < STATE_STORE_MAX_SUBSCRIBERS; ++i) {
+        CHECK(state_store_subscribe(&store, STATE_FIELD_POWER, prv_on_change,
+                    &change) == 0);
+    }
+    CHECK(state_store_subscribe(&store, STATE_FIELD_POWER, prv_on_change,
+                &change) != 0);
+}
+
+/* The writer sets power to the parity of temperature after each change of
+ * temperature, so the snapshot of an even version has them agree. */
+static void* prv_writer(void* arg)
+{
+    state_store_t* store = (state_store_t*)arg;
+    for (int i = 1; i <= WRITES; ++i) {
+        state_store_set_temperature(store, i);
+        state_store_set_power(store, i & 1);
+    }
+    return NULL;
+}
+
+static void test_concurrent_reads_are_consistent()
+{
+    state_store_t store;
+    pthread_t writer;
+    device_state_t state;
+    unsigned long last_version = 0;
+    int inconsistent = 0;
+    int backwards = 0;
+
+    state_store_init(&store);
+    CHECK(pthread_create(&writer, NULL, prv_writer, &store) == 0);
+    do {
+        state_store_read(&store, &state);
+        if (state.version < last_version) {
+            backwards++;
+        }
+        last_version = state.version;
+        // Both fields of a version are written by the same iteration.
+        if (state.version % 2 == 0 && state.temperature != 0
+                && state.power != (state.temperature & 1)) {
+            inconsistent++;
+        }
+        if (state.version % 2 == 1 && state.temperature != (int)
+                (state.version + 1) / 2) {
+            inconsistent++;
+        }
+    } while (state.version < 2 * WRITES);
+    pthread_join(writer, NULL);
+    CHECK_EQ_INT(0, backwards);
+    CHECK_EQ_INT(0, inconsistent);
+}
+
+int main()
+{
+    TEST_RUN(test_version_and_subscribers);
+    TEST_RUN(test_subscribers_are_limited);
+    TEST_RUN(test_concurrent_reads_are_consistent);
+    return TEST_EXIT();
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,244 @@
+#include "test.h"
+#include "sys_cb_impl.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define CONCURRENT_CONNECTS 8
+
+/* TLS server on all loopback addresses, so that 127.0.0.x are distinct
+ * peers of the same server. A connection is kept open until the client
+ * closes it. */
+static SSL_CTX* m_server_ctx;
+static int m_listen_fd;
+static unsigned int m_port;
+static pthread_t m_accept_thread;
+/* Connections served, which must end before the process exits. */
+static int m_serving = 0;
+static pthread_mutex_t m_serving_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m_serving_cond = PTHREAD_COND_INITIALIZER;
+
+static void* prv_serve_connection(void* arg)
+{
+    int fd = (int)(intptr_t)arg;
+    char buffer[256];
+    SSL* ssl = SSL_new(m_server_ctx);
+    SSL_set_fd(ssl, fd);
+    if (SSL_accept(ssl) == 1) {
+        while (SSL_read(ssl, buffer, sizeof(buffer)) > 0) {
+        }
+    }
+    SSL_free(ssl);
+    close(fd);
+    pthread_mutex_lock(&m_serving_mutex);
+    m_serving--;
+    pthread_cond_signal(&m_serving_cond);
+    pthread_mutex_unlock(&m_serving_mutex);
+    return NULL;
+}
+
+static void* prv_accept_loop(void* arg)
+{
+    while (1) {
+        int fd = accept(m_listen_fd, NULL, NULL);
+        if (fd < 0) {
+            return NULL;
+        }
+        pthread_t thread;
+        pthread_mutex_lock(&m_serving_mutex);
+        m_serving++;
+        pthread_mutex_unlock(&m_serving_mutex);
+        pthread_create(&thread, NULL, prv_serve_connection,
+                (void*)(intptr_t)fd);
+        pthread_detach(thread);
+    }
+}
+
+static int prv_start_server()
+{
+    EVP_PKEY* key = EVP_EC_gen("P-256");
+    X509* cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN",
+            MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+    X509_set_issuer_name(cert, X509_get_subject_name(cert));
+    X509_set_pubkey(cert, key);
+    X509_sign(cert, key, EVP_sha256());
+
+    m_server_ctx = SSL_CTX_new(TLS_server_method());
+    if (SSL_CTX_use_certificate(m_server_ctx, cert) != 1
+            || SSL_CTX_use_PrivateKey(m_server_ctx, key) != 1) {
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (bind(m_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+            || listen(m_listen_fd, 64) != 0
+            || getsockname(m_listen_fd, (struct sockaddr*)&addr, &len) != 0) {
+        return -1;
+    }
+    m_port = ntohs(addr.sin_port);
+
+    pthread_create(&m_accept_thread, NULL, prv_accept_loop, NULL);
+    return 0;
+}
+
+/* Connections end when the client closes them. */
+static void prv_stop_server()
+{
+    shutdown(m_listen_fd, SHUT_RDWR);
+    pthread_join(m_accept_thread, NULL);
+    close(m_listen_fd);
+    pthread_mutex_lock(&m_serving_mutex);
+    while (m_serving > 0) {
+        pthread_cond_wait(&m_serving_cond, &m_serving_mutex);
+    }
+    pthread_mutex_unlock(&m_serving_mutex);
+    SSL_CTX_free(m_server_ctx);
+}
+
+static void prv_ctx_init(socket_context_t* ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->socket = -1;
+    ctx->to_recv = 5;
+    ctx->to_send = 5;
+}
+
+static khc_sock_code_t prv_connect(socket_context_t* ctx, const char* host)
+{
+    prv_ctx_init(ctx);
+    return sock_cb_connect(ctx, host, m_port);
+}
+
+static void prv_stats_delta(const sock_cb_stats_t* before,
+        unsigned long* out_lookups, unsigned long* out_hits)
+{
+    sock_cb_stats_t after;
+    sock_cb_get_stats(&after);
+    *out_lookups = after.dns_lookups - before->dns_lookups;
+    *out_hits = after.dns_hits - before->dns_hits;
+}
+
+typedef struct {
+    const char* host;
+    socket_context_t ctx;
+    khc_sock_code_t ret;
+} prv_connect_arg_t;
+
+static void* prv_connect_thread(void* arg)
+{
+    prv_connect_arg_t* connect_arg = (prv_connect_arg_t*)arg;
+    connect_arg->ret = prv_connect(&connect_arg->ctx, connect_arg->host);
+    return NULL;
+}
+
+static void test_concurrent_connects_look_up_once()
+{
+    prv_connect_arg_t args[CONCURRENT_CONNECTS];
+    pthread_t threads[CONCURRENT_CONNECTS];
+    sock_cb_stats_t before;
+    unsigned long lookups;
+    unsigned long hits;
+
+    sock_cb_get_stats(&before);
+    for (int i = 0; i < CONCURRENT_CONNECTS; ++i) {
+        args[i].host = "localhost";
+        pthread_create(&threads[i], NULL, prv_connect_thread, &args[i]);
+    }
+    for (int i = 0; i < CONCURRENT_CONNECTS; ++i) {
+        pthread_join(threads[i], NULL);
+        CHECK(args[i].ret == KHC_SOCK_OK);
+    }
+    prv_stats_delta(&before, &lookups, &hits);
+    CHECK_EQ_INT(1, lookups);
+    CHECK_EQ_INT(CONCURRENT_CONNECTS - 1, hits);
+    for (int i = 0; i < CONCURRENT_CONNECTS; ++i) {
+        CHECK(sock_cb_close(&args[i].ctx) == KHC_SOCK_OK);
+    }
+}
+
+static void test_open_peers_are_not_evicted()
+{
+    const char* hosts[SOCK_PEER_CACHE_SIZE] = {
+        "localhost", "127.0.0.2", "127.0.0.3", "127.0.0.4"
+    };
+    socket_context_t open[SOCK_PEER_CACHE_SIZE];
+    socket_context_t extra;
+    sock_cb_stats_t before;
+    unsigned long lookups;
+    unsigned long hits;
+
+    // All peers of the cache are referenced by open connections.
+    for (int i = 0; i < SOCK_PEER_CACHE_SIZE; ++i) {
+        CHECK(prv_connect(&open[i], hosts[i]) == KHC_SOCK_OK);
+    }
+
+    // Another peer is connected without caching it.
+    sock_cb_get_stats(&before);
+    CHECK(prv_connect(&extra, "127.0.0.5") == KHC_SOCK_OK);
+    CHECK(sock_cb_close(&extra) == KHC_SOCK_OK);
+    CHECK(prv_connect(&extra, "127.0.0.5") == KHC_SOCK_OK);
+    CHECK(sock_cb_close(&extra) == KHC_SOCK_OK);
+    prv_stats_delta(&before, &lookups, &hits);
+    CHECK_EQ_INT(2, lookups);
+    CHECK_EQ_INT(0, hits);
+
+    // A closed peer is replaced.
+    CHECK(sock_cb_close(&open[0]) == KHC_SOCK_OK);
+    sock_cb_get_stats(&before);
+    CHECK(prv_connect(&extra, "127.0.0.5") == KHC_SOCK_OK);
+    CHECK(sock_cb_close(&extra) == KHC_SOCK_OK);
+    CHECK(prv_connect(&extra, "127.0.0.5") == KHC_SOCK_OK);
+    CHECK(sock_cb_close(&extra) == KHC_SOCK_OK);
+    prv_stats_delta(&before, &lookups, &hits);
+    CHECK_EQ_INT(1, lookups);
+    CHECK_EQ_INT(1, hits);
+
+    // Peers of open connections are still cached.
+    sock_cb_get_stats(&before);
+    for (int i = 1; i < SOCK_PEER_CACHE_SIZE; ++i) {
+        CHECK(prv_connect(&extra, hosts[i]) == KHC_SOCK_OK);
+        CHECK(sock_cb_close(&extra) == KHC_SOCK_OK);
+        CHECK(sock_cb_close(&open[i]) == KHC_SOCK_OK);
+    }
+    prv_stats_delta(&before, &lookups, &hits);
+    CHECK_EQ_INT(0, lookups);
+    CHECK_EQ_INT(SOCK_PEER_CACHE_SIZE - 1, hits);
+}
+
+int main()
+{
+    sock_cb_config_t config;
+
+    // Either side may write to a connection the other has closed.
+    signal(SIGPIPE, SIG_IGN);
+    if (prv_start_server() != 0) {
+        printf("failed to start server\n");
+        return 1;
+    }
+    memset(&config, 0, sizeof(config));
+    sock_cb_configure(&config);
+
+    TEST_RUN(test_concurrent_connects_look_up_once);
+    TEST_RUN(test_open_peers_are_not_evicted);
+    prv_stop_server();
+    return TEST_EXIT();
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
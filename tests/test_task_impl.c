@@ -0,0 +1,168 @@
+#include "test.h"
+#include "linux-env/task_impl.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEBOUNCE_MS 20
+
+static unsigned long prv_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+static unsigned long prv_delay_ms(wakeable_delay_t* delay, unsigned int msec)
+{
+    unsigned long start = prv_now_ms();
+    wakeable_delay_ms_cb(msec, delay);
+    return prv_now_ms() - start;
+}
+
+typedef struct {
+    wakeable_delay_t* delay;
+    atomic_bool stop;
+} prv_waker_t;
+
+/* Wakes more often than the quiet period, so the burst never settles. */
+static void* prv_waker(void* arg)
+{
+    prv_waker_t* waker = (prv_waker_t*)arg;
+    while (!waker->stop) {
+        delay_wake(waker->delay);
+        usleep(DEBOUNCE_MS * 1000 / 4);
+    }
+    return NULL;
+}
+
+static void test_wake_ends_delay_after_quiet_period()
+{
+    wakeable_delay_t delay;
+    wakeable_delay_init(&delay, DEBOUNCE_MS);
+
+    CHECK(prv_delay_ms(&delay, 50) >= 50);
+    // A wake while no delay runs is kept for the next delay.
+    delay_wake(&delay);
+    unsigned long elapsed = prv_delay_ms(&delay, 5000);
+    CHECK(elapsed >= DEBOUNCE_MS && elapsed < 1000);
+    // and is consumed.
+    CHECK(prv_delay_ms(&delay, 50) >= 50);
+}
+
+static void test_endless_burst_is_capped()
+{
+    wakeable_delay_t delay;
+    prv_waker_t waker;
+    pthread_t thread;
+
+    wakeable_delay_init(&delay, DEBOUNCE_MS);
+    waker.delay = &delay;
+    atomic_init(&waker.stop, false);
+    CHECK(pthread_create(&thread, NULL, prv_waker, &waker) == 0);
+    unsigned long elapsed = prv_delay_ms(&delay, 5000);
+    waker.stop = true;
+    pthread_join(thread, NULL);
+    // 10 quiet periods at most.
+    CHECK(elapsed < 1000);
+
+    // Wakes of the burst do not end the next delay.
+    CHECK(prv_delay_ms(&delay, 50) >= 50);
+}
+
+typedef struct {
+    atomic_bool release;
+    atomic_bool exited;
+    uintptr_t stack;
+} prv_task_t;
+
+static void* prv_task(void* arg)
+{
+    prv_task_t* task = (prv_task_t*)arg;
+    unsigned char local;
+    task->stack = (uintptr_t)&local;
+    while (!task->release) {
+        usleep(1000);
+    }
+    task->exited = true;
+    return NULL;
+}
+
+static void prv_start_tasks(prv_task_t* tasks, int num)
+{
+    for (int i = 0; i < num; ++i) {
+        atomic_init(&tasks[i].release, false);
+        atomic_init(&tasks[i].exited, false);
+        tasks[i].stack = 0;
+        CHECK(task_create_cb("test", prv_task, &tasks[i], NULL)
+                == KII_TASKC_OK);
+    }
+    for (int i = 0; i < num; ++i) {
+        while (tasks[i].stack == 0) {
+            usleep(1000);
+        }
+    }
+}
+
+static void prv_stop_tasks(prv_task_t* tasks, int num)
+{
+    for (int i = 0; i < num; ++i) {
+        tasks[i].release = true;
+    }
+    for (int i = 0; i < num; ++i) {
+        while (!tasks[i].exited) {
+            usleep(1000);
+        }
+    }
+}
+
+/* True if the stack of task is one of the stacks of tasks. */
+static bool prv_same_stack(const prv_task_t* task, const prv_task_t* tasks,
+        int num)
+{
+    for (int i = 0; i < num; ++i) {
+        uintptr_t diff = task->stack > tasks[i].stack ?
+            task->stack - tasks[i].stack : tasks[i].stack - task->stack;
+        if (diff < TASK_STACK_SIZE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void test_stacks_are_reused_after_restart()
+{
+    prv_task_t first[TASK_STACK_NUM];
+    prv_task_t again[TASK_STACK_NUM];
+    prv_task_t extra;
+
+    prv_start_tasks(first, TASK_STACK_NUM);
+    // All slots are running: a stack from the system.
+    prv_start_tasks(&extra, 1);
+    CHECK(!prv_same_stack(&extra, first, TASK_STACK_NUM));
+    prv_stop_tasks(&extra, 1);
+    prv_stop_tasks(first, TASK_STACK_NUM);
+
+    // Tasks of a thing started again.
+    for (int round = 0; round < 3; ++round) {
+        prv_start_tasks(again, TASK_STACK_NUM);
+        for (int i = 0; i < TASK_STACK_NUM; ++i) {
+            CHECK(prv_same_stack(&again[i], first, TASK_STACK_NUM));
+        }
+        prv_stop_tasks(again, TASK_STACK_NUM);
+    }
+}
+
+int main()
+{
+    TEST_RUN(test_wake_ends_delay_after_quiet_period);
+    TEST_RUN(test_endless_burst_is_capped);
+    TEST_RUN(test_stacks_are_reused_after_restart);
+    return TEST_EXIT();
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
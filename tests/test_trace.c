@@ -0,0 +1,103 @@
+#include "test.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char m_dir[] = "/tmp/test_trace.XXXXXX";
+
+static size_t prv_count(const char* path, const char* needle)
+{
+    char buffer[4096];
+    size_t count = 0;
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    size_t len = fread(buffer, 1, sizeof(buffer) - 1, fp);
+    fclose(fp);
+    buffer[len] = '\0';
+    for (const char* p = buffer; (p = strstr(p, needle)) != NULL; ++p) {
+        count++;
+    }
+    return count;
+}
+
+static void test_export_to_file()
+{
+    char path[300];
+    struct stat st;
+
+    uint32_t trace_id = trace_begin();
+    CHECK(trace_id != 0);
+    trace_span(trace_id, "dispatch", 100, 150);
+    trace_span(trace_id, "actuate", 150, 170);
+    // Not sampled.
+    trace_span(0, "ignored", 150, 170);
+
+    snprintf(path, sizeof(path), "%s/sub/trace.json", m_dir);
+    CHECK_EQ_INT(2, trace_export_chrome_file(path));
+    CHECK(stat(path, &st) == 0);
+    CHECK_EQ_INT(0600, st.st_mode & 0777);
+    snprintf(path, sizeof(path), "%s/sub", m_dir);
+    CHECK(stat(path, &st) == 0);
+    CHECK_EQ_INT(0700, st.st_mode & 0777);
+
+    snprintf(path, sizeof(path), "%s/sub/trace.json", m_dir);
+    CHECK_EQ_INT(1, prv_count(path, "\"name\":\"actuate\""));
+    CHECK_EQ_INT(1, prv_count(path, "\"dur\":50"));
+}
+
+static void test_symlink_is_not_followed()
+{
+    char target[300];
+    char link[300];
+    char content[16];
+
+    snprintf(target, sizeof(target), "%s/target", m_dir);
+    snprintf(link, sizeof(link), "%s/link.json", m_dir);
+    FILE* fp = fopen(target, "w");
+    fputs("keep", fp);
+    fclose(fp);
+    CHECK(symlink(target, link) == 0);
+
+    CHECK(trace_export_chrome_file(link) < 0);
+    fp = fopen(target, "r");
+    CHECK(fgets(content, sizeof(content), fp) != NULL);
+    fclose(fp);
+    CHECK(strcmp(content, "keep") == 0);
+}
+
+static void test_ring_keeps_latest()
+{
+    char path[300];
+
+    uint32_t trace_id = trace_begin();
+    for (int i = 0; i < TRACE_RING_SIZE + 10; ++i) {
+        trace_span(trace_id, i < 10 ? "old" : "new", 0, 1);
+    }
+    snprintf(path, sizeof(path), "%s/ring.json", m_dir);
+    CHECK_EQ_INT(TRACE_RING_SIZE, trace_export_chrome_file(path));
+}
+
+int main()
+{
+    if (mkdtemp(m_dir) == NULL) {
+        printf("failed to create %s\n", m_dir);
+        return 1;
+    }
+    trace_set_sample_rate(1);
+
+    TEST_RUN(test_export_to_file);
+    TEST_RUN(test_symlink_is_not_followed);
+    TEST_RUN(test_ring_keeps_latest);
+
+    char command[300];
+    snprintf(command, sizeof(command), "rm -rf %s", m_dir);
+    system(command);
+    return TEST_EXIT();
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,144 @@
+#include "test.h"
+#include "upload_scheduler.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#define THING_NUM 4
+#define PERIOD_MS 400
+#define SLOT_MS (PERIOD_MS / THING_NUM)
+#define DEBOUNCE_MS 5
+#define TOLERANCE_MS 30
+#define MAX_WAKES 16
+
+/* Waits on its updater delay like the updater of a thing. */
+typedef struct {
+    wakeable_delay_t delay;
+    atomic_bool stopping;
+    pthread_t thread;
+    unsigned long wakes[MAX_WAKES];
+    atomic_int wake_num;
+} prv_thing_t;
+
+static unsigned long m_start_ms;
+
+static unsigned long prv_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+static void* prv_updater(void* arg)
+{
+    prv_thing_t* thing = (prv_thing_t*)arg;
+    while (1) {
+        wakeable_delay_ms_cb(10 * PERIOD_MS, &thing->delay);
+        if (thing->stopping) {
+            return NULL;
+        }
+        int n = thing->wake_num;
+        if (n < MAX_WAKES) {
+            thing->wakes[n] = prv_now_ms() - m_start_ms;
+            thing->wake_num = n + 1;
+        }
+    }
+}
+
+static void prv_start(prv_thing_t* thing)
+{
+    thing->stopping = false;
+    thing->wake_num = 0;
+    CHECK(pthread_create(&thing->thread, NULL, prv_updater, thing) == 0);
+}
+
+static void prv_stop(prv_thing_t* thing)
+{
+    thing->stopping = true;
+    delay_wake(&thing->delay);
+    pthread_join(thing->thread, NULL);
+}
+
+/* Distance of the wake from the slot of the thing on the grid. */
+static unsigned long prv_off_slot_ms(unsigned long wake_ms, int index)
+{
+    unsigned long slot_ms = (index + 1) * SLOT_MS + DEBOUNCE_MS;
+    unsigned long phase = (wake_ms + PERIOD_MS - slot_ms % PERIOD_MS)
+        % PERIOD_MS;
+    return phase < PERIOD_MS - phase ? phase : PERIOD_MS - phase;
+}
+
+static void test_slots_spread_over_period()
+{
+    upload_scheduler_t scheduler;
+    prv_thing_t things[THING_NUM];
+
+    upload_scheduler_init(&scheduler, PERIOD_MS);
+    for (int i = 0; i < THING_NUM; ++i) {
+        wakeable_delay_init(&things[i].delay, DEBOUNCE_MS);
+        CHECK(upload_scheduler_add(&scheduler, &things[i].delay) == 0);
+    }
+    m_start_ms = prv_now_ms();
+    for (int i = 0; i < THING_NUM; ++i) {
+        prv_start(&things[i]);
+    }
+    CHECK(upload_scheduler_start(&scheduler) == 0);
+
+    // Two periods: each thing is woken once a period, in its own slot.
+    usleep((2 * PERIOD_MS + SLOT_MS / 2) * 1000);
+    for (int i = 0; i < THING_NUM; ++i) {
+        CHECK_EQ_INT(2, things[i].wake_num);
+        for (int w = 0; w < things[i].wake_num; ++w) {
+            CHECK(prv_off_slot_ms(things[i].wakes[w], i) < TOLERANCE_MS);
+        }
+    }
+
+    // A thing stopped and started again, as on re-onboarding, keeps its
+    // slot. A wake missed while it was stopped ends its first delay.
+    prv_stop(&things[1]);
+    usleep(PERIOD_MS * 1000);
+    prv_start(&things[1]);
+    usleep(2 * PERIOD_MS * 1000);
+    upload_scheduler_stop(&scheduler);
+
+    int n = things[1].wake_num;
+    CHECK(n >= 2);
+    for (int w = n - 2; w < n; ++w) {
+        CHECK(prv_off_slot_ms(things[1].wakes[w], 1) < TOLERANCE_MS);
+    }
+    // Others were not disturbed.
+    for (int i = 0; i < THING_NUM; ++i) {
+        if (i != 1) {
+            CHECK_EQ_INT(5, things[i].wake_num);
+        }
+    }
+    for (int i = 0; i < THING_NUM; ++i) {
+        prv_stop(&things[i]);
+    }
+}
+
+static void test_full_and_empty()
+{
+    upload_scheduler_t scheduler;
+    wakeable_delay_t delay;
+
+    wakeable_delay_init(&delay, DEBOUNCE_MS);
+    upload_scheduler_init(&scheduler, PERIOD_MS);
+    CHECK(upload_scheduler_start(&scheduler) != 0);
+    for (int i = 0; i < UPLOAD_SCHEDULER_MAX_SLOTS; ++i) {
+        CHECK(upload_scheduler_add(&scheduler, &delay) == 0);
+    }
+    CHECK(upload_scheduler_add(&scheduler, &delay) != 0);
+}
+
+int main()
+{
+    TEST_RUN(test_slots_spread_over_period);
+    TEST_RUN(test_full_and_empty);
+    return TEST_EXIT();
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
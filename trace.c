@@ -0,0 +1,153 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static trace_span_t m_ring[TRACE_RING_SIZE];
+static size_t m_ring_next = 0;
+static size_t m_ring_count = 0;
+static pthread_mutex_t m_ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Copy of the ring being exported. Exports are serialized by
+ * m_export_mutex, so that the copy is not allocated per export. */
+static trace_span_t m_export[TRACE_RING_SIZE];
+static pthread_mutex_t m_export_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_uint m_sample_rate = 1;
+static atomic_uint m_commands = 0;
+static atomic_uint m_last_trace_id = 0;
+
+static __thread uint64_t m_recv_start_us = 0;
+static __thread uint64_t m_recv_last_us = 0;
+
+uint64_t trace_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void trace_set_sample_rate(unsigned int rate)
+{
+    atomic_store(&m_sample_rate, rate);
+}
+
+uint32_t trace_begin()
+{
+    unsigned int rate = atomic_load(&m_sample_rate);
+    if (rate == 0) {
+        return 0;
+    }
+    if (atomic_fetch_add(&m_commands, 1) % rate != 0) {
+        return 0;
+    }
+    uint32_t id = atomic_fetch_add(&m_last_trace_id, 1) + 1;
+    return id != 0 ? id : atomic_fetch_add(&m_last_trace_id, 1) + 1;
+}
+
+void trace_span(
+        uint32_t trace_id,
+        const char* name,
+        uint64_t start_us,
+        uint64_t end_us)
+{
+    if (trace_id == 0) {
+        return;
+    }
+    uint32_t tid = (uint32_t)syscall(SYS_gettid);
+    pthread_mutex_lock(&m_ring_mutex);
+    trace_span_t* span = &m_ring[m_ring_next];
+    span->trace_id = trace_id;
+    span->tid = tid;
+    span->name = name;
+    span->start_us = start_us;
+    span->dur_us = end_us > start_us ? end_us - start_us : 0;
+    m_ring_next = (m_ring_next + 1) % TRACE_RING_SIZE;
+    if (m_ring_count < TRACE_RING_SIZE) {
+        m_ring_count++;
+    }
+    pthread_mutex_unlock(&m_ring_mutex);
+}
+
+void trace_note_recv()
+{
+    uint64_t now = trace_now_us();
+    if (now - m_recv_last_us > TRACE_RECV_GAP_US) {
+        m_recv_start_us = now;
+    }
+    m_recv_last_us = now;
+}
+
+uint64_t trace_recv_start_us()
+{
+    return m_recv_start_us;
+}
+
+size_t trace_export_chrome(FILE* fp)
+{
+    size_t written = 0;
+
+    pthread_mutex_lock(&m_export_mutex);
+    pthread_mutex_lock(&m_ring_mutex);
+    size_t count = m_ring_count;
+    size_t first = (m_ring_next + TRACE_RING_SIZE - count) % TRACE_RING_SIZE;
+    for (size_t i = 0; i < count; ++i) {
+        m_export[i] = m_ring[(first + i) % TRACE_RING_SIZE];
+    }
+    pthread_mutex_unlock(&m_ring_mutex);
+
+    fprintf(fp, "{\"traceEvents\":[");
+    for (size_t i = 0; i < count; ++i) {
+        const trace_span_t* span = &m_export[i];
+        fprintf(fp,
+                "%s\n{\"name\":\"%s\",\"cat\":\"command\",\"ph\":\"X\","
+                "\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%u,"
+                "\"args\":{\"trace\":%u}}",
+                i == 0 ? "" : ",",
+                span->name,
+                (unsigned long long)span->start_us,
+                (unsigned long long)span->dur_us,
+                span->tid,
+                span->trace_id);
+        written++;
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    pthread_mutex_unlock(&m_export_mutex);
+    return written;
+}
+
+long trace_export_chrome_file(const char* path)
+{
+    char dir_path[PATH_MAX];
+
+    strncpy(dir_path, path, sizeof(dir_path) - 1);
+    dir_path[sizeof(dir_path) - 1] = '\0';
+    if (mkdir(dirname(dir_path), 0700) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+            0600);
+    if (fd < 0) {
+        return -1;
+    }
+    FILE* fp = fdopen(fd, "w");
+    if (fp == NULL) {
+        close(fd);
+        return -1;
+    }
+    size_t spans = trace_export_chrome(fp);
+    if (fclose(fp) != 0) {
+        return -1;
+    }
+    return (long)spans;
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
@@ -0,0 +1,80 @@
+#ifndef __TRACE
+#define __TRACE
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_RING_SIZE 1024
+/* Received bytes after this gap start a new message. */
+#define TRACE_RECV_GAP_US 50000
+
+typedef struct {
+    uint32_t trace_id;
+    uint32_t tid;
+    /* Static string. */
+    const char* name;
+    uint64_t start_us;
+    uint64_t dur_us;
+} trace_span_t;
+
+/** Set sampling rate. 1 traces every command, N one of N, 0 none. */
+void trace_set_sample_rate(unsigned int rate);
+
+/** Start a trace of one command.
+ *
+ * @return id of the new trace, or 0 if not sampled.
+ */
+uint32_t trace_begin();
+
+/** Add a span to the ring. Does nothing if trace_id is 0.
+ *
+ * @param [in] trace_id id returned by trace_begin().
+ * @param [in] name static string to name the span.
+ * @param [in] start_us start time from trace_now_us().
+ * @param [in] end_us end time from trace_now_us().
+ */
+void trace_span(
+        uint32_t trace_id,
+        const char* name,
+        uint64_t start_us,
+        uint64_t end_us);
+
+/** CLOCK_MONOTONIC in microseconds. */
+uint64_t trace_now_us();
+
+/** Note that bytes are received on this thread. */
+void trace_note_recv();
+
+/** Time the message being received on this thread started to arrive. */
+uint64_t trace_recv_start_us();
+
+/** Write spans in the ring as Chrome trace event JSON.
+ *
+ * Open the file with chrome://tracing or https://ui.perfetto.dev
+ * Spans are copied under the lock of the ring and written after it is
+ * released, so that a slow file does not block tracing.
+ *
+ * @return number of spans written.
+ */
+size_t trace_export_chrome(FILE* fp);
+
+/** Write spans to a file with trace_export_chrome().
+ *
+ * The file is created with mode 0600, or truncated. A symbolic link at
+ * path is not followed. The directory of path is created with mode 0700
+ * if missing.
+ *
+ * @return number of spans written, or -1 if the file cannot be written.
+ */
+long trace_export_chrome_file(const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TRACE */
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
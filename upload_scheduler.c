@@ -0,0 +1,88 @@
+#include "upload_scheduler.h"
+
+#include <string.h>
+#include <time.h>
+
+static void prv_add_ms(struct timespec* ts, unsigned int msec)
+{
+    ts->tv_sec += msec / 1000;
+    ts->tv_nsec += (long)(msec % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void* prv_timer(void* param)
+{
+    upload_scheduler_t* scheduler = (upload_scheduler_t*)param;
+    unsigned int slot_ms = scheduler->period_ms / scheduler->slot_num;
+    struct timespec next;
+    int slot = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    pthread_mutex_lock(&scheduler->mutex);
+    while (!scheduler->stopped) {
+        /* Slots are kept on a fixed grid, so delays do not add up. */
+        prv_add_ms(&next, slot_ms);
+        while (!scheduler->stopped) {
+            if (pthread_cond_timedwait(&scheduler->cond, &scheduler->mutex,
+                        &next) != 0) {
+                break;
+            }
+        }
+        if (scheduler->stopped) {
+            break;
+        }
+        pthread_mutex_unlock(&scheduler->mutex);
+        delay_wake(scheduler->delays[slot]);
+        slot = (slot + 1) % scheduler->slot_num;
+        pthread_mutex_lock(&scheduler->mutex);
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+    return NULL;
+}
+
+void upload_scheduler_init(upload_scheduler_t* scheduler, unsigned int period_ms)
+{
+    pthread_condattr_t attr;
+
+    memset(scheduler, 0, sizeof(*scheduler));
+    scheduler->period_ms = period_ms;
+    pthread_mutex_init(&scheduler->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&scheduler->cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+int upload_scheduler_add(upload_scheduler_t* scheduler, wakeable_delay_t* delay)
+{
+    if (scheduler->slot_num >= UPLOAD_SCHEDULER_MAX_SLOTS) {
+        return -1;
+    }
+    scheduler->delays[scheduler->slot_num++] = delay;
+    return 0;
+}
+
+int upload_scheduler_start(upload_scheduler_t* scheduler)
+{
+    if (scheduler->slot_num == 0) {
+        return -1;
+    }
+    if (pthread_create(&scheduler->thread, NULL, prv_timer, scheduler) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void upload_scheduler_stop(upload_scheduler_t* scheduler)
+{
+    pthread_mutex_lock(&scheduler->mutex);
+    scheduler->stopped = 1;
+    pthread_cond_signal(&scheduler->cond);
+    pthread_mutex_unlock(&scheduler->mutex);
+    pthread_join(scheduler->thread, NULL);
+}
+
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */
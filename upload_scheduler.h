@@ -0,0 +1,48 @@
+#ifndef __UPLOAD_SCHEDULER
+#define __UPLOAD_SCHEDULER
+
+#include <pthread.h>
+
+#include "linux-env/task_impl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UPLOAD_SCHEDULER_MAX_SLOTS 32
+
+/* One timer for state uploads of many things. The period is split in
+ * equal slots and each slot wakes the updater delay of one thing, so that
+ * uploads are spread over the period instead of made in bursts. */
+typedef struct {
+    wakeable_delay_t* delays[UPLOAD_SCHEDULER_MAX_SLOTS];
+    int slot_num;
+    unsigned int period_ms;
+    int stopped;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+} upload_scheduler_t;
+
+void upload_scheduler_init(upload_scheduler_t* scheduler, unsigned int period_ms);
+
+/** Add a slot. Call before upload_scheduler_start().
+ *
+ * @return 0 if succeeded, -1 if all slots are taken.
+ */
+int upload_scheduler_add(upload_scheduler_t* scheduler, wakeable_delay_t* delay);
+
+/** Start the timer thread.
+ *
+ * @return 0 if succeeded, otherwise -1.
+ */
+int upload_scheduler_start(upload_scheduler_t* scheduler);
+
+void upload_scheduler_stop(upload_scheduler_t* scheduler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UPLOAD_SCHEDULER */
+/* vim: set ts=4 sts=4 sw=4 et fenc=utf-8 ff=unix: */